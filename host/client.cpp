@@ -0,0 +1,339 @@
+/*
+ * client.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <vector>
+#include "client.h"
+
+namespace motor_control {
+
+static const int read_poll_ms = 20;
+
+
+static std::optional<int> optional_int(const JsonValue &v)
+{
+	if(v.is_number())
+		return (int) v.as_int();
+	return std::nullopt;
+}
+
+
+bool Telemetry::empty() const
+{
+	return !heading && !abs_heading && !heading_error && !distance && !accel && !ultrasonic && !pose;
+}
+
+
+Telemetry Telemetry::decode(const JsonValue &line)
+{
+	Telemetry t;
+
+	t.heading = optional_int(line["heading"]);
+	t.abs_heading = optional_int(line["absHeading"]);
+	t.heading_error = optional_int(line["headingErr"]);
+	t.distance = optional_int(line["distance"]);
+
+	const JsonValue &a = line["accel"];
+	if(a.is_object())
+		t.accel = Accel{ (int) a["x"].as_int(), (int) a["y"].as_int(), (int) a["z"].as_int() };
+
+	const JsonValue &u = line["ultrasonic"];
+	if(u.is_object())
+		t.ultrasonic = Ultrasonic{ (int) u["left"].as_int(-1),
+								   (int) u["right"].as_int(-1),
+								   (int) u["front"].as_int(-1),
+								   (int) u["back"].as_int(-1) };
+
+	const JsonValue &p = line["pose"];
+	if(p.is_object())
+		t.pose = Pose{ (int) p["x"].as_int(), (int) p["y"].as_int(), (int) p["theta"].as_int() };
+
+	return t;
+}
+
+
+Client::Client(const std::string &device, int baud, std::chrono::milliseconds request_timeout)
+	: port_(device, baud),
+	  request_timeout_(request_timeout),
+	  next_id_(1),
+	  disconnected_(false),
+	  stopping_(false)
+{
+	reader_ = std::thread(&Client::reader_loop, this);
+}
+
+
+Client::~Client()
+{
+	/* The reader must be out of read() before the fd is closed, or it could read
+	 * from whatever reuses the fd number */
+	stopping_ = true;
+	port_.wake();
+	reader_.join();
+	port_.close();
+
+	fail_requests(std::make_exception_ptr(TimeoutError("client closed")));
+}
+
+
+int Client::allocate_id()
+{
+	/* Ids wrap at max_id; skip any that are still waiting for a response, and the
+	 * one reserved for events */
+	for(int tries = 0; tries <= max_id; tries++)
+	{
+		int id = next_id_;
+		next_id_ = next_id_ >= max_id ? 1 : next_id_ + 1;
+		if(id != async_id && pending_.count(id) == 0)
+			return id;
+	}
+
+	throw std::runtime_error("no free request ids");
+}
+
+
+std::future<Response> Client::send(const std::string &command)
+{
+	std::string name = command.substr(0, command.find(' '));
+	std::future<Response> future;
+	std::string line;
+	int id;
+
+	if(name.empty())
+		throw std::invalid_argument("empty command");
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if(disconnected_)
+			throw SerialError("board disconnected");
+		id = allocate_id();
+
+		line = std::to_string(id) + " " + command;
+		if(line.size() > max_line_length)
+			throw std::invalid_argument("command too long for firmware buffer: " + line);
+
+		std::unique_ptr<Pending> p(new Pending);
+		p->command = name;
+		p->sent = std::chrono::steady_clock::now();
+		future = p->promise.get_future();
+		pending_[id] = std::move(p);
+	}
+
+	try
+	{
+		port_.write(line + "\r");
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_.erase(id);
+		throw;
+	}
+
+	return future;
+}
+
+
+Response Client::call(const std::string &command)
+{
+	return send(command).get();
+}
+
+
+void Client::on_telemetry(std::function<void(const Telemetry &)> callback)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	telemetry_callback_ = callback;
+}
+
+
+void Client::on_event(std::function<void(const Event &)> callback)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	event_callback_ = callback;
+}
+
+
+void Client::on_unmatched(std::function<void(const std::string &)> callback)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	unmatched_callback_ = callback;
+}
+
+
+std::map<std::string, LatencyHistogram> Client::latency_stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return latency_;
+}
+
+
+size_t Client::pending() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_.size();
+}
+
+
+bool Client::connected() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return !disconnected_;
+}
+
+
+void Client::reader_loop()
+{
+	std::vector<char> buffer(256);
+	std::string line;
+
+	while(!stopping_)
+	{
+		size_t n = port_.read(buffer.data(), buffer.size(), read_poll_ms);
+
+		for(size_t i = 0; i < n; i++)
+		{
+			char c = buffer[i];
+
+			/* Responses end in "\n", or "\r\n" in interactive mode */
+			if(c == '\n')
+			{
+				if(!line.empty())
+					handle_line(line);
+				line.clear();
+			}
+			else if(c != '\r')
+			{
+				line += c;
+			}
+		}
+
+		/* A hung up port returns at once from every read, so stop rather than spin */
+		if(port_.hung_up())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				disconnected_ = true;
+			}
+			fail_requests(std::make_exception_ptr(SerialError("board disconnected")));
+			return;
+		}
+
+		expire_requests(std::chrono::steady_clock::now());
+	}
+}
+
+
+void Client::handle_line(const std::string &line)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::function<void(const Telemetry &)> telemetry_callback;
+	std::function<void(const Event &)> event_callback;
+	std::function<void(const std::string &)> unmatched_callback;
+	std::unique_ptr<Pending> matched;
+	JsonValue body;
+	bool is_json = JsonValue::parse(line, body) && body.is_object();
+	int id = is_json && body["id"].is_number() ? (int) body["id"].as_int() : -1;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		telemetry_callback = telemetry_callback_;
+		event_callback = event_callback_;
+		unmatched_callback = unmatched_callback_;
+
+		auto it = id == async_id ? pending_.end() : pending_.find(id);
+		if(it != pending_.end())
+		{
+			matched = std::move(it->second);
+			pending_.erase(it);
+		}
+	}
+
+	/* Deliver telemetry first so it is visible by the time a waiter wakes up */
+	if(is_json && telemetry_callback)
+	{
+		Telemetry t = Telemetry::decode(body);
+		if(!t.empty())
+			telemetry_callback(t);
+	}
+
+	if(id == async_id)
+	{
+		if(event_callback)
+		{
+			Event e;
+			e.name = body["msg"].as_string();
+			e.src = (int) body["src"].as_int();
+			e.age = (int) body["age"].as_int();
+			e.body = body;
+			event_callback(e);
+		}
+		else if(unmatched_callback)
+		{
+			unmatched_callback(line);
+		}
+	}
+	else if(matched)
+	{
+		Response r;
+		r.result = body["result"].as_bool();
+		r.msg = body["msg"].as_string();
+		r.id = id;
+		r.body = body;
+		r.latency = std::chrono::duration_cast<std::chrono::microseconds>(now - matched->sent);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			latency_[matched->command].record(r.latency);
+		}
+		matched->promise.set_value(r);
+	}
+	else if(unmatched_callback)
+	{
+		unmatched_callback(line);
+	}
+}
+
+
+void Client::expire_requests(std::chrono::steady_clock::time_point now)
+{
+	std::vector<std::unique_ptr<Pending>> expired;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(auto it = pending_.begin(); it != pending_.end();)
+		{
+			if(now - it->second->sent > request_timeout_)
+			{
+				expired.push_back(std::move(it->second));
+				it = pending_.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	for(auto &p : expired)
+		p->promise.set_exception(std::make_exception_ptr(TimeoutError(p->command + " timed out")));
+}
+
+
+/* Only once send() can no longer add requests: after a hangup, or on destruction */
+void Client::fail_requests(std::exception_ptr error)
+{
+	std::map<int, std::unique_ptr<Pending>> failed;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		failed.swap(pending_);
+	}
+
+	for(auto &p : failed)
+		p.second->promise.set_exception(error);
+}
+
+} // namespace motor_control
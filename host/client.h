@@ -0,0 +1,165 @@
+/*
+ * client.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Host-side client for the motor controller's serial command interface.
+ *
+ * Commands are sent in non-interactive mode, i.e. "<id> <command> [args]\r", and
+ * the firmware answers with one JSON object per line carrying the same id (see
+ * json.c and parse_command() in serial_interactive.c). Long commands are answered
+ * once they finish: move, set, turn_abs and turn_rel by the PID loop when the
+ * motion completes (or with an "obstacle" or "drop" error if a stop brakes the
+ * robot first), and left_grab, left_drop, right_grab and right_drop when the
+ * servo sequence ends. So several requests may be outstanding at once; responses are matched to
+ * requests by id on a background reader thread. Lines with id async_id are
+ * events, not responses, and go to on_event(). Telemetry, including the odometry
+ * pose in "sensors" responses, is decoded from every line for on_telemetry().
+ */
+
+#ifndef CLIENT_H_
+#define CLIENT_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "json_value.h"
+#include "latency_histogram.h"
+#include "serial_port.h"
+
+namespace motor_control {
+
+class TimeoutError : public std::runtime_error {
+public:
+	explicit TimeoutError(const std::string &what) : std::runtime_error(what) {}
+};
+
+struct Response {
+	bool result;
+	std::string msg;
+	int id;
+	JsonValue body;								//!< The whole decoded response object
+	std::chrono::microseconds latency;
+};
+
+/**
+ * Asynchronous event pushed by the firmware (see event.h), e.g. an accelerometer
+ * motion or free-fall detection.
+ */
+struct Event {
+	std::string name;							//!< "msg", e.g. "motion"
+	int src;									//!< Event specific detail
+	int age;									//!< ms between detection and sending
+	JsonValue body;
+};
+
+/**
+ * Sensor and motion values decoded from any line the firmware sends. Fields the
+ * line did not carry are left empty.
+ */
+struct Telemetry {
+	struct Accel { int x, y, z; };
+	struct Ultrasonic { int left, right, front, back; };
+	struct Pose { int x, y, theta; };			//!< mm east, mm north, tenths of a degree
+
+	std::optional<int> heading;					//!< "heading", from sensors
+	std::optional<int> abs_heading;				//!< "absHeading", from the PID loop
+	std::optional<int> heading_error;			//!< "headingErr", from the PID loop
+	std::optional<int> distance;				//!< "distance", encoder ticks
+	std::optional<Accel> accel;
+	std::optional<Ultrasonic> ultrasonic;
+	std::optional<Pose> pose;					//!< "pose", encoder odometry
+
+	bool empty() const;
+	static Telemetry decode(const JsonValue &line);
+};
+
+class Client {
+public:
+	/** Longest line parse_command() accepts, not counting the '\r' */
+	static const size_t max_line_length = 31;
+	/** Ids are parsed with atoi() into a 16-bit int on the AVR */
+	static const int max_id = 32767;
+	/** Id the firmware uses for events, ASYNC_RESP_ID in SerialCommands.h; never
+	 *  allocated to a request */
+	static const int async_id = 0x05;
+
+	explicit Client(const std::string &device,
+					int baud = SerialPort::default_baud,
+					std::chrono::milliseconds request_timeout = std::chrono::seconds(30));
+	~Client();
+
+	Client(const Client &) = delete;
+	Client &operator=(const Client &) = delete;
+
+	/**
+	 * Send a command and return a future for its response. The future throws
+	 * TimeoutError if nothing arrives within the request timeout, or SerialError
+	 * if the board hangs up first.
+	 *
+	 * @param command Command and arguments, e.g. "sensors" or "set 0 100 500"
+	 * @throws std::invalid_argument if the line would not fit the firmware's buffer
+	 * @throws SerialError if the board has hung up or the write fails
+	 */
+	std::future<Response> send(const std::string &command);
+
+	/** Blocking convenience wrapper around send() */
+	Response call(const std::string &command);
+
+	/** Called on the reader thread for every line that carries telemetry */
+	void on_telemetry(std::function<void(const Telemetry &)> callback);
+
+	/** Called on the reader thread for every event the firmware pushes */
+	void on_event(std::function<void(const Event &)> callback);
+
+	/** Called on the reader thread for lines not matched to a request */
+	void on_unmatched(std::function<void(const std::string &)> callback);
+
+	/** Snapshot of the round-trip latency histograms, keyed by command name */
+	std::map<std::string, LatencyHistogram> latency_stats() const;
+
+	size_t pending() const;
+
+	/** False once the board has hung up; the reader thread has stopped by then */
+	bool connected() const;
+
+private:
+	struct Pending {
+		std::string command;
+		std::chrono::steady_clock::time_point sent;
+		std::promise<Response> promise;
+	};
+
+	void reader_loop();
+	void handle_line(const std::string &line);
+	void expire_requests(std::chrono::steady_clock::time_point now);
+	void fail_requests(std::exception_ptr error);
+	int allocate_id();
+
+	SerialPort port_;
+	std::chrono::milliseconds request_timeout_;
+
+	mutable std::mutex mutex_;
+	std::map<int, std::unique_ptr<Pending>> pending_;
+	std::map<std::string, LatencyHistogram> latency_;
+	std::function<void(const Telemetry &)> telemetry_callback_;
+	std::function<void(const Event &)> event_callback_;
+	std::function<void(const std::string &)> unmatched_callback_;
+	int next_id_;
+	bool disconnected_;
+
+	std::atomic<bool> stopping_;
+	std::thread reader_;
+};
+
+} // namespace motor_control
+
+#endif /* CLIENT_H_ */
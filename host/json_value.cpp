@@ -0,0 +1,230 @@
+/*
+ * json_value.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include "json_value.h"
+
+namespace motor_control {
+
+/**
+ * Recursive descent parser. Kept private to this file; JsonValue::parse is the
+ * only entry point.
+ */
+class JsonParser {
+public:
+	explicit JsonParser(const std::string &text) : s_(text), pos_(0) {}
+
+	bool parse_document(JsonValue &out)
+	{
+		if(!parse_value(out, 0))
+			return false;
+		skip_space();
+		return pos_ == s_.size();
+	}
+
+private:
+	static const int max_depth = 16;
+
+	const std::string &s_;
+	size_t pos_;
+
+	void skip_space()
+	{
+		while(pos_ < s_.size() && isspace((unsigned char) s_[pos_]))
+			pos_++;
+	}
+
+	bool consume(char c)
+	{
+		skip_space();
+		if(pos_ < s_.size() && s_[pos_] == c)
+		{
+			pos_++;
+			return true;
+		}
+		return false;
+	}
+
+	bool consume_word(const char *word)
+	{
+		size_t len = std::char_traits<char>::length(word);
+		if(s_.compare(pos_, len, word) != 0)
+			return false;
+		pos_ += len;
+		return true;
+	}
+
+	bool parse_string(std::string &out)
+	{
+		if(!consume('"'))
+			return false;
+
+		out.clear();
+		while(pos_ < s_.size())
+		{
+			char c = s_[pos_++];
+			if(c == '"')
+				return true;
+			if(c == '\\')
+			{
+				if(pos_ >= s_.size())
+					return false;
+				c = s_[pos_++];
+				switch(c)
+				{
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case '"':
+				case '\\':
+				case '/': out += c; break;
+				default: return false;
+				}
+			}
+			else
+			{
+				out += c;
+			}
+		}
+		return false;
+	}
+
+	bool parse_number(JsonValue &out)
+	{
+		const char *start = s_.c_str() + pos_;
+		char *end;
+		long value = strtol(start, &end, 10);
+
+		if(end == start)
+			return false;
+		pos_ += end - start;
+		out.type_ = JsonValue::Type::Number;
+		out.number_ = value;
+		return true;
+	}
+
+	bool parse_value(JsonValue &out, int depth)
+	{
+		if(depth > max_depth)
+			return false;
+
+		skip_space();
+		if(pos_ >= s_.size())
+			return false;
+
+		char c = s_[pos_];
+		if(c == '{')
+		{
+			pos_++;
+			out.type_ = JsonValue::Type::Object;
+			if(consume('}'))
+				return true;
+			do
+			{
+				std::string key;
+				JsonValue value;
+				skip_space();
+				if(!parse_string(key) || !consume(':') || !parse_value(value, depth + 1))
+					return false;
+				out.object_[key] = value;
+			} while(consume(','));
+			return consume('}');
+		}
+		else if(c == '[')
+		{
+			pos_++;
+			out.type_ = JsonValue::Type::Array;
+			if(consume(']'))
+				return true;
+			do
+			{
+				JsonValue value;
+				if(!parse_value(value, depth + 1))
+					return false;
+				out.array_.push_back(value);
+			} while(consume(','));
+			return consume(']');
+		}
+		else if(c == '"')
+		{
+			out.type_ = JsonValue::Type::String;
+			return parse_string(out.string_);
+		}
+		else if(consume_word("true"))
+		{
+			out.type_ = JsonValue::Type::Bool;
+			out.boolean_ = true;
+			return true;
+		}
+		else if(consume_word("false"))
+		{
+			out.type_ = JsonValue::Type::Bool;
+			out.boolean_ = false;
+			return true;
+		}
+		else if(consume_word("null"))
+		{
+			out.type_ = JsonValue::Type::Null;
+			return true;
+		}
+
+		return parse_number(out);
+	}
+};
+
+
+bool JsonValue::parse(const std::string &text, JsonValue &out)
+{
+	JsonValue result;
+	JsonParser parser(text);
+
+	if(!parser.parse_document(result))
+		return false;
+
+	out = result;
+	return true;
+}
+
+
+long JsonValue::as_int(long fallback) const
+{
+	if(type_ == Type::Number)
+		return number_;
+	if(type_ == Type::Bool)
+		return boolean_ ? 1 : 0;
+	return fallback;
+}
+
+
+bool JsonValue::as_bool(bool fallback) const
+{
+	if(type_ == Type::Bool)
+		return boolean_;
+	if(type_ == Type::Number)
+		return number_ != 0;
+	return fallback;
+}
+
+
+bool JsonValue::has(const std::string &key) const
+{
+	return type_ == Type::Object && object_.count(key) != 0;
+}
+
+
+const JsonValue &JsonValue::operator[](const std::string &key) const
+{
+	static const JsonValue null_value;
+
+	if(type_ != Type::Object)
+		return null_value;
+
+	std::map<std::string, JsonValue>::const_iterator it = object_.find(key);
+	return it == object_.end() ? null_value : it->second;
+}
+
+} // namespace motor_control
@@ -0,0 +1,61 @@
+/*
+ * json_value.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Minimal JSON reader for the single-line responses produced by json.c in the
+ * firmware. Only what the firmware emits is supported: objects, arrays, strings
+ * without unicode escapes, integers, booleans and null.
+ */
+
+#ifndef JSON_VALUE_H_
+#define JSON_VALUE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace motor_control {
+
+class JsonValue {
+public:
+	enum class Type { Null, Bool, Number, String, Array, Object };
+
+	JsonValue() : type_(Type::Null), number_(0), boolean_(false) {}
+
+	/**
+	 * Parse a complete JSON document. Returns false (and leaves out untouched)
+	 * if the text is not valid JSON.
+	 */
+	static bool parse(const std::string &text, JsonValue &out);
+
+	Type type() const { return type_; }
+	bool is_object() const { return type_ == Type::Object; }
+	bool is_number() const { return type_ == Type::Number; }
+
+	long as_int(long fallback = 0) const;
+	bool as_bool(bool fallback = false) const;
+	const std::string &as_string() const { return string_; }
+	const std::vector<JsonValue> &as_array() const { return array_; }
+	const std::map<std::string, JsonValue> &as_object() const { return object_; }
+
+	bool has(const std::string &key) const;
+
+	/** Returns the member named key, or a null value if there is none. */
+	const JsonValue &operator[](const std::string &key) const;
+
+private:
+	friend class JsonParser;
+
+	Type type_;
+	long number_;
+	bool boolean_;
+	std::string string_;
+	std::vector<JsonValue> array_;
+	std::map<std::string, JsonValue> object_;
+};
+
+} // namespace motor_control
+
+#endif /* JSON_VALUE_H_ */
@@ -0,0 +1,76 @@
+/*
+ * latency_histogram.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <algorithm>
+#include <sstream>
+#include "latency_histogram.h"
+
+namespace motor_control {
+
+LatencyHistogram::LatencyHistogram()
+	: count_(0), sum_us_(0), min_us_(0), max_us_(0)
+{
+	buckets_.fill(0);
+}
+
+
+void LatencyHistogram::record(std::chrono::microseconds latency)
+{
+	uint64_t us = latency.count() > 0 ? latency.count() : 0;
+	size_t bucket = 0;
+
+	while(bucket + 1 < num_buckets && (us >> (bucket + 1)) != 0)
+		bucket++;
+
+	buckets_[bucket]++;
+	min_us_ = count_ == 0 ? us : std::min(min_us_, us);
+	max_us_ = std::max(max_us_, us);
+	sum_us_ += us;
+	count_++;
+}
+
+
+std::chrono::microseconds LatencyHistogram::mean() const
+{
+	return std::chrono::microseconds(count_ ? sum_us_ / count_ : 0);
+}
+
+
+std::chrono::microseconds LatencyHistogram::percentile(double p) const
+{
+	if(count_ == 0)
+		return std::chrono::microseconds(0);
+
+	uint64_t rank = (uint64_t) (p / 100.0 * count_ + 0.5);
+	uint64_t seen = 0;
+
+	rank = std::max<uint64_t>(1, std::min(rank, count_));
+	for(size_t i = 0; i < num_buckets; i++)
+	{
+		seen += buckets_[i];
+		if(seen >= rank)
+			return std::chrono::microseconds(std::min<uint64_t>((2ull << i) - 1, max_us_));
+	}
+
+	return max();
+}
+
+
+std::string LatencyHistogram::summary() const
+{
+	std::ostringstream out;
+
+	out << "n=" << count_
+		<< " min=" << min().count() << "us"
+		<< " mean=" << mean().count() << "us"
+		<< " p50=" << percentile(50).count() << "us"
+		<< " p99=" << percentile(99).count() << "us"
+		<< " max=" << max().count() << "us";
+
+	return out.str();
+}
+
+} // namespace motor_control
@@ -0,0 +1,54 @@
+/*
+ * latency_histogram.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Round-trip latency histogram with power-of-two microsecond buckets. Bucket n
+ * counts samples in [2^n, 2^(n+1)) us, so 24 buckets cover up to ~16 s.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace motor_control {
+
+class LatencyHistogram {
+public:
+	static const size_t num_buckets = 24;
+
+	LatencyHistogram();
+
+	void record(std::chrono::microseconds latency);
+
+	uint64_t count() const { return count_; }
+	std::chrono::microseconds min() const { return std::chrono::microseconds(min_us_); }
+	std::chrono::microseconds max() const { return std::chrono::microseconds(max_us_); }
+	std::chrono::microseconds mean() const;
+
+	/**
+	 * Estimate a percentile (0-100) from the buckets. The result is the upper
+	 * edge of the bucket containing the requested rank, clamped to max().
+	 */
+	std::chrono::microseconds percentile(double p) const;
+
+	const std::array<uint64_t, num_buckets> &buckets() const { return buckets_; }
+
+	/** One-line human readable summary, e.g. for logging */
+	std::string summary() const;
+
+private:
+	std::array<uint64_t, num_buckets> buckets_;
+	uint64_t count_;
+	uint64_t sum_us_;
+	uint64_t min_us_;
+	uint64_t max_us_;
+};
+
+} // namespace motor_control
+
+#endif /* LATENCY_HISTOGRAM_H_ */
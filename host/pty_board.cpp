@@ -0,0 +1,132 @@
+/*
+ * pty_board.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "serial_port.h"
+#include "pty_board.h"
+
+namespace motor_control {
+
+PtyBoard::PtyBoard(Handler handler)
+	: handler_(handler), master_fd_(-1), slave_fd_(-1), stopping_(false)
+{
+	struct termios tio;
+
+	master_fd_ = posix_openpt(O_RDWR | O_NOCTTY);
+	if(master_fd_ < 0 || grantpt(master_fd_) != 0 || unlockpt(master_fd_) != 0)
+		throw SerialError(std::string("posix_openpt: ") + strerror(errno));
+
+	device_path_ = ptsname(master_fd_);
+
+	/* Hold the slave open so the master does not see a hangup between clients,
+	 * and put it in raw mode so "\r" and "\n" pass through untranslated.
+	 */
+	slave_fd_ = open(device_path_.c_str(), O_RDWR | O_NOCTTY);
+	if(slave_fd_ >= 0 && tcgetattr(slave_fd_, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tcsetattr(slave_fd_, TCSANOW, &tio);
+	}
+
+	thread_ = std::thread(&PtyBoard::serve, this);
+}
+
+
+PtyBoard::~PtyBoard()
+{
+	stopping_ = true;
+	thread_.join();
+	if(slave_fd_ >= 0)
+		close(slave_fd_);
+	close(master_fd_);
+}
+
+
+std::string PtyBoard::response(bool result, const std::string &msg, int id, const std::string &extra)
+{
+	std::string line = "{\"result\":";
+
+	line += result ? "true" : "false";
+	line += ",\"msg\":\"" + msg + "\",\"id\":" + std::to_string(id);
+	if(!extra.empty())
+		line += "," + extra;
+	line += "}";
+
+	return line;
+}
+
+
+void PtyBoard::emit(const std::string &line)
+{
+	std::lock_guard<std::mutex> lock(write_mutex_);
+	std::string out = line + "\n";
+	size_t written = 0;
+
+	while(written < out.size())
+	{
+		ssize_t n = write(master_fd_, out.data() + written, out.size() - written);
+		if(n < 0)
+		{
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			return;
+		}
+		written += n;
+	}
+}
+
+
+void PtyBoard::serve()
+{
+	std::string line;
+	char buffer[64];
+
+	while(!stopping_)
+	{
+		struct pollfd pfd = { master_fd_, POLLIN, 0 };
+
+		if(poll(&pfd, 1, 20) <= 0 || !(pfd.revents & POLLIN))
+			continue;
+
+		ssize_t n = read(master_fd_, buffer, sizeof(buffer));
+		for(ssize_t i = 0; i < n; i++)
+		{
+			/* parse_command() reads up to '\r' and silently drops the rest of an
+			 * over-long line; mirror that so clients see the same behaviour.
+			 */
+			if(buffer[i] != '\r')
+			{
+				if(line.size() < 31 && isprint((unsigned char) buffer[i]))
+					line += buffer[i];
+				continue;
+			}
+
+			if(!line.empty())
+			{
+				size_t first = line.find(' ');
+				int id = atoi(line.c_str());
+				std::string rest = first == std::string::npos ? "" : line.substr(first + 1);
+				size_t second = rest.find(' ');
+				std::string command = rest.substr(0, second);
+				std::string args = second == std::string::npos ? "" : rest.substr(second + 1);
+				std::string reply = handler_(id, command, args);
+
+				if(!reply.empty())
+					emit(reply);
+			}
+			line.clear();
+		}
+	}
+}
+
+} // namespace motor_control
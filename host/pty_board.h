@@ -0,0 +1,62 @@
+/*
+ * pty_board.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * A stand-in for the motor controller on a local pseudo-terminal, so that code
+ * using Client can be exercised without hardware. Point a Client at
+ * device_path() and answer commands from the handler.
+ */
+
+#ifndef PTY_BOARD_H_
+#define PTY_BOARD_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace motor_control {
+
+class PtyBoard {
+public:
+	/**
+	 * Called for each command line received. Returns the JSON response line
+	 * without the trailing newline, or an empty string to send nothing (as the
+	 * firmware does for long commands until the motion completes).
+	 */
+	typedef std::function<std::string(int id, const std::string &command,
+									  const std::string &args)> Handler;
+
+	explicit PtyBoard(Handler handler);
+	~PtyBoard();
+
+	PtyBoard(const PtyBoard &) = delete;
+	PtyBoard &operator=(const PtyBoard &) = delete;
+
+	/** Path of the slave side, e.g. /dev/pts/3 */
+	const std::string &device_path() const { return device_path_; }
+
+	/** Send an unsolicited line, e.g. a delayed long-command response */
+	void emit(const std::string &line);
+
+	/** Build a response the same way json_start_response()/json_end_response() do */
+	static std::string response(bool result, const std::string &msg, int id,
+								const std::string &extra = "");
+
+private:
+	void serve();
+
+	Handler handler_;
+	int master_fd_;
+	int slave_fd_;
+	std::string device_path_;
+	std::mutex write_mutex_;
+	std::atomic<bool> stopping_;
+	std::thread thread_;
+};
+
+} // namespace motor_control
+
+#endif /* PTY_BOARD_H_ */
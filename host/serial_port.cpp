@@ -0,0 +1,152 @@
+/*
+ * serial_port.cpp
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "serial_port.h"
+
+namespace motor_control {
+
+static speed_t baud_to_speed(int baud)
+{
+	switch(baud)
+	{
+	case 2400: return B2400;
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	default: throw SerialError("unsupported baud rate " + std::to_string(baud));
+	}
+}
+
+
+static std::string errno_string(const std::string &what)
+{
+	return what + ": " + strerror(errno);
+}
+
+
+SerialPort::SerialPort(const std::string &device, int baud)
+	: fd_(-1), hung_up_(false)
+{
+	struct termios tio;
+	speed_t speed = baud_to_speed(baud);
+
+	int fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if(fd < 0)
+		throw SerialError(errno_string("open " + device));
+
+	if(pipe(wake_pipe_) != 0)
+	{
+		::close(fd);
+		throw SerialError(errno_string("pipe"));
+	}
+
+	if(tcgetattr(fd, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+
+	fd_ = fd;
+}
+
+
+SerialPort::~SerialPort()
+{
+	close();
+	::close(wake_pipe_[0]);
+	::close(wake_pipe_[1]);
+}
+
+
+void SerialPort::write(const std::string &data)
+{
+	size_t written = 0;
+
+	while(written < data.size())
+	{
+		int fd = fd_;
+		if(fd < 0)
+			throw SerialError("write on closed port");
+
+		ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+		if(n < 0)
+		{
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			throw SerialError(errno_string("write"));
+		}
+		written += n;
+	}
+}
+
+
+size_t SerialPort::read(char *buffer, size_t size, int timeout_ms)
+{
+	struct pollfd fds[2];
+	int fd = fd_;
+
+	if(fd < 0)
+		return 0;
+
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = wake_pipe_[0];
+	fds[1].events = POLLIN;
+
+	int ready = poll(fds, 2, timeout_ms);
+	if(ready <= 0 || (fds[1].revents & POLLIN) || fd_ < 0)
+		return 0;
+
+	/* A pty whose other end has gone away reports POLLHUP, and keeps reporting it
+	 * at once on every poll, so it is final rather than another timeout */
+	bool hangup = fds[0].revents & (POLLHUP | POLLERR);
+	if(hangup && !(fds[0].revents & POLLIN))
+	{
+		hung_up_ = true;
+		return 0;
+	}
+
+	ssize_t n = ::read(fd, buffer, size);
+	if(n > 0)
+		return n;
+
+	if(hangup || (n < 0 && errno != EINTR && errno != EAGAIN))
+		hung_up_ = true;
+	return 0;
+}
+
+
+void SerialPort::wake()
+{
+	char c = 0;
+
+	if(::write(wake_pipe_[1], &c, 1) < 0) { /* reader will time out instead */ }
+}
+
+
+void SerialPort::close()
+{
+	int fd = fd_.exchange(-1);
+
+	if(fd >= 0)
+		::close(fd);
+}
+
+} // namespace motor_control
@@ -0,0 +1,73 @@
+/*
+ * serial_port.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Thin POSIX wrapper around a serial device or pseudo-terminal, configured for
+ * the raw 8N1 link used by debug_uart in the firmware.
+ */
+
+#ifndef SERIAL_PORT_H_
+#define SERIAL_PORT_H_
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+namespace motor_control {
+
+class SerialError : public std::runtime_error {
+public:
+	explicit SerialError(const std::string &what) : std::runtime_error(what) {}
+};
+
+class SerialPort {
+public:
+	/** Baud rate of debug_uart, see init_uarts() in uart.c */
+	static const int default_baud = 19200;
+
+	/**
+	 * Open and configure a device. Pseudo-terminals ignore the baud rate.
+	 *
+	 * @throws SerialError if the device cannot be opened or configured
+	 */
+	SerialPort(const std::string &device, int baud = default_baud);
+	~SerialPort();
+
+	SerialPort(const SerialPort &) = delete;
+	SerialPort &operator=(const SerialPort &) = delete;
+
+	/** Write all of data, retrying on partial writes. */
+	void write(const std::string &data);
+
+	/**
+	 * Read whatever is available, waiting at most timeout_ms for the first byte.
+	 *
+	 * @return Number of bytes read, 0 on timeout or once hung_up()
+	 */
+	size_t read(char *buffer, size_t size, int timeout_ms);
+
+	/** True once read() has seen the device go away, e.g. the board side of a pty
+	 *  closing. Nothing more will arrive, so stop reading. */
+	bool hung_up() const { return hung_up_; }
+
+	/** Make a reader waiting in read() return early. The port stays open. */
+	void wake();
+
+	/**
+	 * Close the device and refuse further I/O. Nothing may be inside read() or
+	 * write() at the time, so stop and join any reader thread first.
+	 */
+	void close();
+
+	int fd() const { return fd_; }
+
+private:
+	std::atomic<int> fd_;
+	std::atomic<bool> hung_up_;
+	int wake_pipe_[2];
+};
+
+} // namespace motor_control
+
+#endif /* SERIAL_PORT_H_ */
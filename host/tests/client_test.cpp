@@ -0,0 +1,270 @@
+/*
+ * client_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Runs Client against a PtyBoard: responses matched by id whatever order they
+ * arrive in, events kept apart from responses, requests that time out, and a
+ * board that hangs up.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "client.h"
+#include "pty_board.h"
+
+using namespace motor_control;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if(!(cond)) { \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while(0)
+
+
+/**
+ * Answers "sensors" straight away and holds "move" until release_move(), like
+ * the firmware does until the motion finishes.
+ */
+class FakeBoard {
+public:
+	FakeBoard()
+		: move_id_(-1),
+		  board_([this](int id, const std::string &command, const std::string &args) {
+			  return handle(id, command, args);
+		  })
+	{
+	}
+
+	const std::string &device_path() const { return board_.device_path(); }
+
+	int wait_for_move()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		received_.wait_for(lock, std::chrono::seconds(2), [this] { return move_id_ >= 0; });
+		return move_id_;
+	}
+
+	void release_move(int id)
+	{
+		board_.emit(PtyBoard::response(true, "", id, "\"distance\":500"));
+	}
+
+	void emit(const std::string &line)
+	{
+		board_.emit(line);
+	}
+
+private:
+	std::string handle(int id, const std::string &command, const std::string &)
+	{
+		if(command == "move")
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			move_id_ = id;
+			received_.notify_all();
+			return "";
+		}
+		if(command == "sensors")
+			return PtyBoard::response(true, "", id, "\"heading\":900");
+
+		return PtyBoard::response(false, "unknown command", id);
+	}
+
+	std::mutex mutex_;
+	std::condition_variable received_;
+	int move_id_;
+	PtyBoard board_;
+};
+
+
+/* A long command answered after a later short one still gets its own response */
+static void test_out_of_order_responses(void)
+{
+	FakeBoard board;
+	Client client(board.device_path());
+
+	std::future<Response> move = client.send("move 100 500");
+	int move_id = board.wait_for_move();
+	CHECK(move_id > 0);
+
+	Response sensors = client.call("sensors");
+	CHECK(sensors.result);
+	CHECK(sensors.id != move_id);
+	CHECK(sensors.body["heading"].as_int() == 900);
+	CHECK(client.pending() == 1);
+
+	board.release_move(move_id);
+	CHECK(move.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+	Response r = move.get();
+	CHECK(r.id == move_id);
+	CHECK(r.body["distance"].as_int() == 500);
+	CHECK(client.pending() == 0);
+
+	std::map<std::string, LatencyHistogram> stats = client.latency_stats();
+	CHECK(stats["move"].count() == 1);
+	CHECK(stats["sensors"].count() == 1);
+}
+
+
+/* Events and responses for ids nobody is waiting on must not complete a request */
+static void test_events_and_strays(void)
+{
+	FakeBoard board;
+	Client client(board.device_path());
+	std::mutex mutex;
+	std::condition_variable seen;
+	std::string event_name;
+	int unmatched = 0;
+
+	client.on_event([&](const Event &e) {
+		std::lock_guard<std::mutex> lock(mutex);
+		event_name = e.name;
+		seen.notify_all();
+	});
+	client.on_unmatched([&](const std::string &) {
+		std::lock_guard<std::mutex> lock(mutex);
+		unmatched++;
+		seen.notify_all();
+	});
+
+	std::future<Response> move = client.send("move 100 500");
+	int move_id = board.wait_for_move();
+
+	board.emit("{\"result\":true,\"msg\":\"obstacle\",\"id\":5,\"src\":120,\"age\":3}");
+	board.emit(PtyBoard::response(true, "", move_id + 100));
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		seen.wait_for(lock, std::chrono::seconds(2), [&] { return !event_name.empty() && unmatched > 0; });
+		CHECK(event_name == "obstacle");
+		CHECK(unmatched == 1);
+	}
+	CHECK(move.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout);
+	CHECK(client.pending() == 1);
+
+	board.release_move(move_id);
+	CHECK(move.get().id == move_id);
+}
+
+
+/* Unanswered requests fail with TimeoutError and are forgotten */
+static void test_timeout(void)
+{
+	FakeBoard board;
+	Client client(board.device_path(), SerialPort::default_baud, std::chrono::milliseconds(200));
+	bool timed_out = false;
+
+	std::future<Response> move = client.send("move 100 500");
+	CHECK(move.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+	try
+	{
+		move.get();
+	}
+	catch(const TimeoutError &)
+	{
+		timed_out = true;
+	}
+	CHECK(timed_out);
+	CHECK(client.pending() == 0);
+
+	/* A late answer to the expired request is just unmatched */
+	board.release_move(board.wait_for_move());
+	CHECK(client.call("sensors").result);
+}
+
+
+/* Destroying the client fails whatever is still outstanding */
+static void test_close_with_pending(void)
+{
+	FakeBoard board;
+	std::future<Response> move;
+	bool closed = false;
+
+	{
+		Client client(board.device_path());
+		move = client.send("move 100 500");
+		board.wait_for_move();
+	}
+
+	try
+	{
+		move.get();
+	}
+	catch(const TimeoutError &)
+	{
+		closed = true;
+	}
+	CHECK(closed);
+}
+
+
+/* Once the board hangs up, outstanding requests fail and the reader stops polling */
+static void test_board_hangup(void)
+{
+	std::unique_ptr<FakeBoard> board(new FakeBoard);
+	Client client(board->device_path());
+	bool failed = false;
+	bool refused = false;
+
+	std::future<Response> move = client.send("move 100 500");
+	board->wait_for_move();
+	board.reset();
+
+	CHECK(move.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+	try
+	{
+		move.get();
+	}
+	catch(const SerialError &)
+	{
+		failed = true;
+	}
+	CHECK(failed);
+	CHECK(!client.connected());
+
+	try
+	{
+		client.send("sensors");
+	}
+	catch(const SerialError &)
+	{
+		refused = true;
+	}
+	CHECK(refused);
+
+	/* A reader still polling the hung up pty would use all of this in CPU time */
+	std::clock_t start = std::clock();
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	double cpu_ms = 1000.0 * (std::clock() - start) / CLOCKS_PER_SEC;
+	CHECK(cpu_ms < 50);
+}
+
+
+int main()
+{
+	test_out_of_order_responses();
+	test_events_and_strays();
+	test_timeout();
+	test_close_with_pending();
+	test_board_hangup();
+
+	if(failures)
+	{
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	std::printf("client_test passed\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * fixmath_test.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Sweeps the firmware's integer trig (motor-control/fixmath.c) against the
+ * float versions and checks the error bounds fixmath.c documents.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+extern "C" {
+#include "fixmath.h"
+}
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if(!(cond)) { \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while(0)
+
+static const double TENTHS_TO_RAD = M_PI / 1800;
+
+
+/**
+ * Every tenth of a degree over +/-720 degrees, within 7 LSB.
+ */
+static void test_sin_cos(void)
+{
+	double sin_worst = 0;
+	double cos_worst = 0;
+
+	for(int a = -7200; a <= 7200; a++)
+	{
+		sin_worst = std::fmax(sin_worst, std::fabs(fixmath_sin(a) - FIXMATH_ONE * std::sin(a * TENTHS_TO_RAD)));
+		cos_worst = std::fmax(cos_worst, std::fabs(fixmath_cos(a) - FIXMATH_ONE * std::cos(a * TENTHS_TO_RAD)));
+	}
+
+	CHECK(sin_worst <= 7);
+	CHECK(cos_worst <= 7);
+}
+
+
+/**
+ * Random points at small, medium and full (+/-2^24) scale, within 0.1 degree.
+ */
+static void test_atan2(void)
+{
+	static const long scales[] = { 100, 100000, 1L << 24 };
+	std::mt19937 rng(1);
+	double worst = 0;
+
+	for(int i = 0; i < 600000; i++)
+	{
+		long scale = scales[i % 3];
+		std::uniform_int_distribution<long> component(-scale, scale);
+		long y = component(rng);
+		long x = component(rng);
+		if(!x && !y)
+			continue;
+
+		double exact = std::atan2((double)y, (double)x) / TENTHS_TO_RAD;
+		if(exact < 0)
+			exact += 3600;
+		double error = std::fabs(fixmath_atan2(y, x) - exact);
+		if(error > 1800)
+			error = 3600 - error;
+		worst = std::fmax(worst, error);
+	}
+
+	CHECK(fixmath_atan2(0, 0) == 0);
+	CHECK(worst <= 1);
+}
+
+
+static bool isqrt_exact(unsigned long x)
+{
+	unsigned long r = fixmath_isqrt(x);
+	return r * r <= x && (r + 1) * (r + 1) > x;
+}
+
+
+/**
+ * Exact at the bottom and the top of the 32-bit range.
+ */
+static void test_isqrt(void)
+{
+	int wrong = 0;
+
+	for(unsigned long x = 0; x < 3000000; x++)
+		wrong += !isqrt_exact(x);
+	for(unsigned long x = 0xffffffffUL; x > 0xfff00000UL; x--)
+		wrong += !isqrt_exact(x);
+
+	CHECK(wrong == 0);
+}
+
+
+int main()
+{
+	test_sin_cos();
+	test_atan2();
+	test_isqrt();
+
+	if(failures)
+	{
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	std::printf("fixmath_test passed\n");
+	return 0;
+}
@@ -63,6 +63,7 @@ typedef struct ss sensor_values;
 
 
 /*async response struct for fall detection**/
+/* Not sent; drops are reported as JSON "drop" events instead, see event.h */
 struct async
 {
 
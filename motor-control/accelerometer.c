@@ -6,19 +6,57 @@
  */
 
 
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include "i2c.h"
 #include "debug.h"
+#include "timer.h"
+#include "sensors.h"
+#include "event.h"
 #include "accelerometer.h"
 
+static volatile accel_sample_t ring[ACCEL_RING_SIZE];
+static volatile uint8_t ring_head = 0, ring_tail = 0;
+static volatile accel_stats_t stats;
+
+static i2c_transaction_t drdy_read;
+static uint8_t drdy_tx[] = {ACCEL_OUT_X_MSB};
+static uint8_t drdy_rx[3*ACCEL_FIFO_WATERMARK];
+
+/* INT_SOURCE through PULSE_SRC in one read. Reading the source registers clears
+ * the latched events.
+ */
+static i2c_transaction_t event_read;
+static uint8_t event_tx[] = {ACCEL_INT_SOURCE};
+static uint8_t event_rx[ACCEL_PULSE_SRC - ACCEL_INT_SOURCE + 1];
+
+static uint8_t event_threshold[ACCEL_NUM_EVENTS];
+static uint8_t event_count[ACCEL_NUM_EVENTS];
+
+static accel_cal_t EEMEM cal_eeprom;
+static accel_cal_t cal;
+
+static accel_mode_t mode = ACCEL_MODE_NORMAL;
+static uint8_t odr = ACCEL_ODR;
+static uint8_t who_am_i = 0;
+static volatile bool reconfiguring = false;
+
+/**
+ * Sample rate in Hz for each CTRL_REG1 DR setting, rounded down
+ */
+static const unsigned int odr_hz[] = {800, 400, 200, 100, 50, 12, 6, 1};
+
 
 /**
  * Sign extend 12 bit data to 16 bits
  */
 static inline int16_t sext_12(uint16_t x)
 {
-	if(x > 0x7fff)
+	if(x > 0x7ff)
 		x |= 0xf000;
 
 	return x;
@@ -47,12 +85,224 @@ static inline bool send_receive(uint8_t rx_bytes,
 }
 
 
+/**
+ * Bytes per sample in the current mode
+ */
+static inline uint8_t sample_bytes(void)
+{
+	return (mode == ACCEL_MODE_NORMAL) ? 6 : 3;
+}
+
+
+/**
+ * Decode one sample in the current mode
+ */
+static inline void decode_sample(const uint8_t *raw_data, accelerometer_data_t *a)
+{
+	if(mode == ACCEL_MODE_NORMAL)
+	{
+		accelerometer_decode(raw_data, a);
+	}
+	else
+	{
+		a->x = (int8_t)raw_data[0] << 4;
+		a->y = (int8_t)raw_data[1] << 4;
+		a->z = (int8_t)raw_data[2] << 4;
+	}
+}
+
+
+/**
+ * Add a sample to the ring. When full, the oldest sample makes room; the ring
+ * always holds the latest.
+ */
+static void push_sample(accelerometer_data_t *a)
+{
+	uint8_t next;
+
+	ring[ring_head].a = *a;
+	ring[ring_head].time = tick_count;
+
+	next = (ring_head + 1) % ACCEL_RING_SIZE;
+	if(next == ring_tail)
+	{
+		ring_tail = (ring_tail + 1) % ACCEL_RING_SIZE;
+		stats.dropped++;
+	}
+	ring_head = next;
+}
+
+
+/**
+ * Completion callback for the data-ready read, called from the TWI interrupt.
+ * Queues the samples for accelerometer_pop_sample() and publishes the newest to
+ * the sensor snapshot. A FIFO burst all gets the same timestamp; at FIFO rates
+ * the samples are closer together than one MS_TIMER tick anyway.
+ */
+static void drdy_read_done(i2c_transaction_t *t)
+{
+	accelerometer_data_t a;
+	uint8_t i;
+
+	if(t->status != I2C_STATUS_OK)
+		return;
+
+	for(i = 0; i < t->rx_bytes; i += sample_bytes())
+	{
+		decode_sample(t->rx_data + i, &a);
+		push_sample(&a);
+		stats.samples++;
+	}
+
+	stats.bursts++;
+	sensors_update_accel(&a);
+}
+
+
+/**
+ * Completion callback for the event read, called from the TWI interrupt. Posts an
+ * event for each engine that fired, with its source register.
+ */
+static void event_read_done(i2c_transaction_t *t)
+{
+	uint8_t src;
+
+	if(t->status != I2C_STATUS_OK)
+		return;
+
+	src = t->rx_data[0];
+
+	if(src & ACCEL_INT_SOURCE_SRC_FF_MT_bm)
+		event_post(event_threshold[ACCEL_EVENT_MOTION] ? EVENT_MOTION : EVENT_FREEFALL,
+				   t->rx_data[ACCEL_FF_MT_SRC - ACCEL_INT_SOURCE]);
+	if(src & ACCEL_INT_SOURCE_SRC_TRANS_bm)
+		event_post(EVENT_TRANSIENT, t->rx_data[ACCEL_TRANSIENT_SRC - ACCEL_INT_SOURCE]);
+	if(src & ACCEL_INT_SOURCE_SRC_PULSE_bm)
+		event_post(EVENT_PULSE, t->rx_data[ACCEL_PULSE_SRC - ACCEL_INT_SOURCE]);
+}
+
+
+/**
+ * Write the detection engine settings. Must be called in standby.
+ *
+ * @param int_en Pointer to the CTRL_REG4 value, the enabled engines are added
+ * @return True if the writes succeeded
+ */
+static bool configure_events(uint8_t *int_en)
+{
+	uint8_t ff_mt_cfg = 0, ff_mt_ths = 0, ff_mt_count = 0;
+	uint8_t transient_cfg = 0;
+	uint8_t pulse_cfg = 0;
+	bool ok = true;
+
+	if(event_threshold[ACCEL_EVENT_MOTION])
+	{
+		ff_mt_cfg = ACCEL_FF_MT_CFG_ELE_bm | ACCEL_FF_MT_CFG_OAE_bm
+					| ACCEL_FF_MT_CFG_XEFE_bm | ACCEL_FF_MT_CFG_YEFE_bm;
+		ff_mt_ths = event_threshold[ACCEL_EVENT_MOTION];
+		ff_mt_count = event_count[ACCEL_EVENT_MOTION];
+	}
+	else if(event_threshold[ACCEL_EVENT_FREEFALL])
+	{
+		ff_mt_cfg = ACCEL_FF_MT_CFG_ELE_bm | ACCEL_FF_MT_CFG_XEFE_bm
+					| ACCEL_FF_MT_CFG_YEFE_bm | ACCEL_FF_MT_CFG_ZEFE_bm;
+		ff_mt_ths = event_threshold[ACCEL_EVENT_FREEFALL];
+		ff_mt_count = event_count[ACCEL_EVENT_FREEFALL];
+	}
+
+	if(ff_mt_cfg)
+	{
+		ok = ok
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_FF_MT_THS, ACCEL_FF_MT_THS_DBCNTM_bm | ff_mt_ths))
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_FF_MT_COUNT, ff_mt_count));
+		*int_en |= ACCEL_CTRL_REG4_INT_EN_FF_MT_bm;
+	}
+
+	if(event_threshold[ACCEL_EVENT_TRANSIENT])
+	{
+		/* High-pass filtered, so gravity and a slow tilt don't count */
+		transient_cfg = ACCEL_TRANSIENT_CFG_ELE_bm
+						| ACCEL_TRANSIENT_CFG_XTEFE_bm | ACCEL_TRANSIENT_CFG_YTEFE_bm;
+		ok = ok
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_TRANSIENT_THS,
+												 ACCEL_TRANSIENT_THS_DBCNTM_bm
+												 | event_threshold[ACCEL_EVENT_TRANSIENT]))
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_TRANSIENT_COUNT, event_count[ACCEL_EVENT_TRANSIENT]));
+		*int_en |= ACCEL_CTRL_REG4_INT_EN_TRANS_bm;
+	}
+
+	if(event_threshold[ACCEL_EVENT_PULSE])
+	{
+		pulse_cfg = ACCEL_PULSE_CFG_ELE_bm | ACCEL_PULSE_CFG_XSPEFE_bm
+					| ACCEL_PULSE_CFG_YSPEFE_bm | ACCEL_PULSE_CFG_ZSPEFE_bm;
+		ok = ok
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_PULSE_THSX, event_threshold[ACCEL_EVENT_PULSE]))
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_PULSE_THSY, event_threshold[ACCEL_EVENT_PULSE]))
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_PULSE_THSZ, event_threshold[ACCEL_EVENT_PULSE]))
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_PULSE_TMLT, event_count[ACCEL_EVENT_PULSE]))
+			&& I2C_RETRY(accelerometer_write_ram(ACCEL_PULSE_LTCY, ACCEL_PULSE_LATENCY));
+		*int_en |= ACCEL_CTRL_REG4_INT_EN_PULSE_bm;
+	}
+
+	return ok
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_FF_MT_CFG, ff_mt_cfg))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_TRANSIENT_CFG, transient_cfg))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_PULSE_CFG, pulse_cfg));
+}
+
+
+/**
+ * Write the mode, rate, detection engines and interrupt routing to the part.
+ * Leaves it active. Data-ready or the FIFO go to INT1, everything else to INT2.
+ */
+static bool configure(void)
+{
+	uint8_t ctrl_reg1 = odr;
+	uint8_t f_setup = ACCEL_F_SETUP_F_MODE_DISABLED_gc;
+	uint8_t int_en = 0;
+	uint8_t int_cfg = 0;
+
+	if(mode != ACCEL_MODE_NORMAL)
+		ctrl_reg1 |= ACCEL_CTRL_REG1_F_READ_bm;
+
+#ifdef ACCEL_USE_DRDY
+	int_en = ACCEL_CTRL_REG4_INT_EN_DRDY_bm;
+	int_cfg = ACCEL_CTRL_REG5_INT_CFG_DRDY_bm;
+#endif
+
+	if(mode == ACCEL_MODE_FIFO)
+	{
+		f_setup = ACCEL_F_SETUP_F_MODE_CIRCULAR_gc | ACCEL_FIFO_WATERMARK;
+		int_en = ACCEL_CTRL_REG4_INT_EN_FIFO_bm;
+		int_cfg = ACCEL_CTRL_REG5_INT_CFG_FIFO_bm;
+	}
+
+	drdy_read.rx_bytes = sample_bytes() * ((mode == ACCEL_MODE_FIFO) ? ACCEL_FIFO_WATERMARK : 1);
+
+	/* Control registers can only change in standby */
+	return I2C_RETRY(accelerometer_standby())
+		&& (who_am_i != ACCEL_WHO_AM_I_MMA8451
+			|| I2C_RETRY(accelerometer_write_ram(ACCEL_F_SETUP, f_setup)))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_CTRL_REG1, ctrl_reg1))
+		&& configure_events(&int_en)
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_OFF_X, (cal.magic == ACCEL_CAL_MAGIC) ? cal.offset[0] : 0))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_OFF_Y, (cal.magic == ACCEL_CAL_MAGIC) ? cal.offset[1] : 0))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_OFF_Z, (cal.magic == ACCEL_CAL_MAGIC) ? cal.offset[2] : 0))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_CTRL_REG4, int_en))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_CTRL_REG5, int_cfg))
+		&& I2C_RETRY(accelerometer_active());
+}
+
+
 /**
  * Initializes the accelerometer
+ *
+ * @return True if the accelerometer responded, otherwise false
  */
-void init_accelerometer(void)
+bool init_accelerometer(void)
 {
 	uint8_t xyz_data_cfg;
+	bool ok;
 
 	DEBUG_STATUS(DEBUG_INIT_ACCELEROMETER);
 
@@ -61,12 +311,54 @@ void init_accelerometer(void)
 		xyz_data_cfg = 8;
 	xyz_data_cfg >>= 2;
 
-	while(! accelerometer_standby());
-	while(! accelerometer_write_ram(ACCEL_XYZ_DATA_CFG, xyz_data_cfg));
-	while(! accelerometer_write_ram(ACCEL_CTRL_REG2, 0x80));
-	while(! accelerometer_active());
+	drdy_read.address = ACCEL_TWI_ADDRESS;
+	drdy_read.tx_bytes = sizeof(drdy_tx);
+	drdy_read.tx_data = drdy_tx;
+	drdy_read.rx_data = drdy_rx;
+	drdy_read.callback = drdy_read_done;
+	drdy_read.context = NULL;
+	drdy_read.status = I2C_STATUS_IDLE;
+
+	event_read.address = ACCEL_TWI_ADDRESS;
+	event_read.tx_bytes = sizeof(event_tx);
+	event_read.rx_bytes = sizeof(event_rx);
+	event_read.tx_data = event_tx;
+	event_read.rx_data = event_rx;
+	event_read.callback = event_read_done;
+	event_read.context = NULL;
+	event_read.status = I2C_STATUS_IDLE;
+
+	eeprom_read_block(&cal, &cal_eeprom, sizeof(cal));
+
+	ok = I2C_RETRY(accelerometer_read_ram(ACCEL_WHO_AM_I, &who_am_i))
+		&& I2C_RETRY(accelerometer_standby())
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_XYZ_DATA_CFG, xyz_data_cfg))
+		&& I2C_RETRY(accelerometer_write_ram(ACCEL_CTRL_REG2, ACCEL_CTRL_REG2_MODS_NORMAL_bm))
+		&& configure();
+
+#ifdef ACCEL_USE_DRDY
+	ACCEL_INT_PORT.DIRCLR = ACCEL_INT1_bm;
+	ACCEL_INT_PORT.ACCEL_INT1_PINCTRL = PORT_ISC_FALLING_gc;
+	ACCEL_INT_PORT.INT0MASK = ACCEL_INT1_bm;
+	ACCEL_INT_PORT.INTCTRL = (ACCEL_INT_PORT.INTCTRL & ~PORT_INT0LVL_gm) | PORT_INT0LVL_LO_gc;
+#endif
+
+	ACCEL_INT_PORT.DIRCLR = ACCEL_INT2_bm;
+	ACCEL_INT_PORT.ACCEL_INT2_PINCTRL = PORT_ISC_FALLING_gc;
+	ACCEL_INT_PORT.INT1MASK = ACCEL_INT2_bm;
+	ACCEL_INT_PORT.INTCTRL = (ACCEL_INT_PORT.INTCTRL & ~PORT_INT1LVL_gm) | PORT_INT1LVL_LO_gc;
+
+	PMIC.CTRL |= PMIC_LOLVLEN_bm;
+	sei();
+
+	/* A line may already be low from a sample or event nobody read, and then there
+	 * would never be another edge.
+	 */
+	accelerometer_tick();
 
 	DEBUG_CLEAR_STATUS();
+
+	return ok;
 }
 
 
@@ -94,7 +386,7 @@ bool accelerometer_write_ram(uint8_t address, uint8_t data)
 bool accelerometer_read_ram(uint8_t address, uint8_t *rx_data)
 {
 	uint8_t tx_data[] = {address};
-	return send_receive(sizeof(rx_data), sizeof(tx_data), rx_data, tx_data);
+	return send_receive(1, sizeof(tx_data), rx_data, tx_data);
 }
 
 
@@ -105,7 +397,8 @@ bool accelerometer_standby(void)
 {
 	uint8_t data;
 
-	while(! accelerometer_read_ram(ACCEL_CTRL_REG1, &data));
+	if(! I2C_RETRY(accelerometer_read_ram(ACCEL_CTRL_REG1, &data)))
+		return false;
 	data &= ~ACCEL_CTRL_REG1_ACTIVE_bm;
 
 	return accelerometer_write_ram(ACCEL_CTRL_REG1, data);
@@ -119,7 +412,8 @@ bool accelerometer_active(void)
 {
 	uint8_t data;
 
-	while(! accelerometer_read_ram(ACCEL_CTRL_REG1, &data));
+	if(! I2C_RETRY(accelerometer_read_ram(ACCEL_CTRL_REG1, &data)))
+		return false;
 	data |= ACCEL_CTRL_REG1_ACTIVE_bm;
 
 	return accelerometer_write_ram(ACCEL_CTRL_REG1, data);
@@ -138,15 +432,417 @@ bool accelerometer_get_data(accelerometer_data_t *a)
 	uint8_t tx_data[] = {ACCEL_OUT_X_MSB};
 	bool result_ok;
 
-	result_ok = send_receive(sizeof(raw_data), sizeof(tx_data), raw_data, tx_data);
+	result_ok = send_receive(sample_bytes(), sizeof(tx_data), raw_data, tx_data);
 
 	if(result_ok)
+		decode_sample(raw_data, a);
+
+	return result_ok;
+}
+
+
+/**
+ * Convert the six OUT_X_MSB..OUT_Z_LSB registers to signed 12 bit samples
+ *
+ * @param raw_data Register contents, starting at ACCEL_OUT_X_MSB
+ * @param a Pointer to an accelerometer_data_t struct to fill in
+ */
+void accelerometer_decode(const uint8_t *raw_data, accelerometer_data_t *a)
+{
+	a->x = sext_12((raw_data[0] << 4) | (raw_data[1] >> 4));
+	a->y = sext_12((raw_data[2] << 4) | (raw_data[3] >> 4));
+	a->z = sext_12((raw_data[4] << 4) | (raw_data[5] >> 4));
+}
+
+
+/**
+ * Take the oldest sample from the data-ready ring
+ *
+ * @param s Pointer to an accel_sample_t to fill in
+ * @return True if there was a sample, otherwise false
+ */
+bool accelerometer_pop_sample(accel_sample_t *s)
+{
+	bool ok = false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(ring_tail != ring_head)
+		{
+			*s = *(accel_sample_t *)&ring[ring_tail];
+			ring_tail = (ring_tail + 1) % ACCEL_RING_SIZE;
+			ok = true;
+		}
+	}
+
+	return ok;
+}
+
+
+/**
+ * Number of samples waiting in the data-ready ring, without taking any
+ */
+uint8_t accelerometer_sample_count(void)
+{
+	uint8_t n;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		n = (ring_head + ACCEL_RING_SIZE - ring_tail) % ACCEL_RING_SIZE;
+	}
+
+	return n;
+}
+
+
+void accelerometer_get_stats(accel_stats_t *s)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*s = *(accel_stats_t *)&stats;
+	}
+}
+
+
+/**
+ * Called every MS_TIMER tick. The data-ready line is edge triggered and stays low
+ * until the sample is read, so if a read was lost (I2C error, queue full) no new
+ * edge would ever come. The FIFO line likewise stays low while a burst's worth of
+ * samples is still waiting, and the event line until the sources are read.
+ * Restart reading whenever a line is low and idle.
+ */
+void accelerometer_tick(void)
+{
+	if(reconfiguring)
+		return;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+#ifdef ACCEL_USE_DRDY
+		if(! (ACCEL_INT_PORT.IN & ACCEL_INT1_bm) && ! i2c_in_progress(&drdy_read))
+		{
+			if(i2c_submit(&drdy_read))
+				stats.rearms++;
+		}
+#endif
+
+		if(! (ACCEL_INT_PORT.IN & ACCEL_INT2_bm) && ! i2c_in_progress(&event_read))
+			i2c_submit(&event_read);
+	}
+}
+
+
+/**
+ * Stop the interrupt handlers and accelerometer_tick() from starting reads, and
+ * wait for any in progress, so the part can be reconfigured with blocking I2C.
+ */
+static void begin_reconfigure(void)
+{
+	reconfiguring = true;
+	ACCEL_INT_PORT.INT0MASK &= ~ACCEL_INT1_bm;
+	ACCEL_INT_PORT.INT1MASK &= ~ACCEL_INT2_bm;
+	while(i2c_in_progress(&drdy_read) || i2c_in_progress(&event_read))
+		;
+}
+
+
+static void end_reconfigure(void)
+{
+#ifdef ACCEL_USE_DRDY
+	ACCEL_INT_PORT.INT0MASK |= ACCEL_INT1_bm;
+#endif
+	ACCEL_INT_PORT.INT1MASK |= ACCEL_INT2_bm;
+	reconfiguring = false;
+	accelerometer_tick();
+}
+
+
+/**
+ * Change how samples are read.
+ *
+ * The fast modes read 8 bit samples, half the I2C traffic of normal mode, and the
+ * FIFO mode reads ACCEL_FIFO_WATERMARK of them in one transaction, which is what
+ * makes 400-800 Hz practical. The FIFO is only on the MMA8451, and without
+ * ACCEL_USE_DRDY only normal mode is available since the sensor engine polls 12
+ * bit samples itself.
+ *
+ * Blocks while the part is reconfigured.
+ *
+ * @param new_mode Mode to use
+ * @param rate_hz Output data rate, rounded down to one the part supports, or 0 to
+ * 		  keep the current rate
+ * @return True if the part was reconfigured, otherwise false
+ */
+bool accelerometer_set_mode(accel_mode_t new_mode, unsigned int rate_hz)
+{
+	uint8_t new_odr = odr;
+	uint8_t i;
+	bool ok;
+
+	if(new_mode == ACCEL_MODE_FIFO && who_am_i != ACCEL_WHO_AM_I_MMA8451)
+		return false;
+#ifndef ACCEL_USE_DRDY
+	if(new_mode != ACCEL_MODE_NORMAL)
+		return false;
+#endif
+
+	if(rate_hz != 0)
+	{
+		for(i = 0; i < sizeof(odr_hz)/sizeof(odr_hz[0]) - 1 && odr_hz[i] > rate_hz; i++)
+			;
+		new_odr = i << 3;
+	}
+
+	begin_reconfigure();
+	mode = new_mode;
+	odr = new_odr;
+	ok = configure();
+	end_reconfigure();
+
+	return ok;
+}
+
+
+/**
+ * Divide, rounding to nearest
+ */
+static long div_round(long n, long d)
+{
+	return (n >= 0) ? (n + d/2) / d : (n - d/2) / d;
+}
+
+
+/**
+ * Wait for the next sample for accelerometer_calibrate(). With ACCEL_USE_DRDY
+ * every sample is taken from the data-ready ring, FIFO bursts included;
+ * otherwise the sensor snapshot is watched for a new one.
+ *
+ * @param a Filled in with the sample
+ * @param last_time accel_time of the previous snapshot sample, updated
+ * @return False if nothing arrived within ACCEL_CAL_TIMEOUT_MS
+ */
+static bool next_cal_sample(accelerometer_data_t *a, unsigned long int *last_time)
+{
+	unsigned long int deadline = get_tick_count() + ACCEL_CAL_TIMEOUT_MS / MS_TIMER_PER;
+#ifdef ACCEL_USE_DRDY
+	accel_sample_t s;
+
+	while(! accelerometer_pop_sample(&s))
+	{
+		if(get_tick_count() >= deadline)
+			return false;
+	}
+
+	*a = s.a;
+#else
+	sensor_snapshot_t s;
+
+	do
+	{
+		if(get_tick_count() >= deadline)
+			return false;
+		sensors_get_snapshot(&s);
+	} while(s.accel_time == *last_time);
+
+	*last_time = s.accel_time;
+	*a = s.accel;
+#endif
+
+	return true;
+}
+
+
+/**
+ * Measure the zero-g offsets and store them in the part and in EEPROM.
+ *
+ * The robot must be standing still on level ground: X and Y should read 0 and Z
+ * 1 g. Blocks for samples / ODR seconds or more.
+ *
+ * @param samples Number of samples to average
+ * @return True if the offsets were stored. On failure the previous calibration
+ * 		   is kept.
+ */
+bool accelerometer_calibrate(unsigned int samples)
+{
+	const long one_g = 2048 / ACCEL_GSCALE;				// Counts per g, 12 bit data
+	sensor_snapshot_t s;
+	accelerometer_data_t a;
+#ifdef ACCEL_USE_DRDY
+	accel_sample_t sample;
+#endif
+	accel_cal_t old = cal;
+	unsigned long int last_time;
+	long sum[3] = {0, 0, 0};
+	long error;
+	unsigned int n;
+	uint8_t i;
+	bool ok;
+
+	if(samples == 0)
+		return false;
+
+	/* Measure with no offsets applied */
+	cal.magic = 0;
+	begin_reconfigure();
+	ok = configure();
+	end_reconfigure();
+
+	sensors_get_snapshot(&s);
+	last_time = s.accel_time;
+#ifdef ACCEL_USE_DRDY
+	while(accelerometer_pop_sample(&sample));				// Measured with the old offsets
+#endif
+
+	/* The first sample may predate the change, so it is read and thrown away */
+	for(n = 0; ok && n <= samples; n++)
+	{
+		ok = next_cal_sample(&a, &last_time);
+		if(ok && n > 0)
+		{
+			sum[0] += a.x;
+			sum[1] += a.y;
+			sum[2] += a.z - one_g;
+		}
+	}
+
+	if(ok)
 	{
-		a->x = sext_12((raw_data[0] << 4) | (raw_data[1] >> 4));
-		a->y = sext_12((raw_data[2] << 4) | (raw_data[3] >> 4));
-		a->z = sext_12((raw_data[4] << 4) | (raw_data[5] >> 4));
-		return true;
+		/* Average error in counts, then to 2 mg offset steps with the opposite sign */
+		for(i = 0; i < 3; i++)
+		{
+			error = div_round(sum[i], samples);
+			error = -div_round(error * ACCEL_GSCALE * 1000, 2048L * 2);
+			if(error > 127)
+				error = 127;
+			if(error < -128)
+				error = -128;
+			cal.offset[i] = error;
+		}
+		cal.magic = ACCEL_CAL_MAGIC;
 	}
+	else
+	{
+		cal = old;
+	}
+
+	begin_reconfigure();
+	ok = configure() && ok;
+	end_reconfigure();
+
+	if(ok)
+		eeprom_update_block(&cal, &cal_eeprom, sizeof(cal));
+
+	return ok;
+}
+
+
+/**
+ * Forget the offsets, in the part and in EEPROM
+ */
+bool accelerometer_clear_calibration(void)
+{
+	bool ok;
+
+	cal.magic = 0;
+	eeprom_update_block(&cal, &cal_eeprom, sizeof(cal));
+
+	begin_reconfigure();
+	ok = configure();
+	end_reconfigure();
+
+	return ok;
+}
+
+
+void accelerometer_get_calibration(accel_cal_t *c)
+{
+	*c = cal;
+}
+
+
+/**
+ * Configure one of the detection engines. Its events are posted to the host
+ * through event_post(). Blocks while the part is reconfigured.
+ *
+ * @param event Engine to configure. Enabling motion disables free-fall and vice
+ * 		  versa.
+ * @param threshold Threshold in 0.063 g steps, 1-127, or 0 to disable
+ * @param count Debounce count in ODR periods; for pulses, the longest a pulse can
+ * 		  last
+ * @return True if the part was reconfigured, otherwise false
+ */
+bool accelerometer_set_event(accel_event_t event, uint8_t threshold, uint8_t count)
+{
+	bool ok;
+
+	if(event >= ACCEL_NUM_EVENTS || threshold > 127)
+		return false;
+
+	begin_reconfigure();
+
+	if(event == ACCEL_EVENT_MOTION)
+		event_threshold[ACCEL_EVENT_FREEFALL] = 0;
+	else if(event == ACCEL_EVENT_FREEFALL)
+		event_threshold[ACCEL_EVENT_MOTION] = 0;
+
+	event_threshold[event] = threshold;
+	event_count[event] = count;
+	ok = configure();
 
-	return false;
+	end_reconfigure();
+
+	return ok;
+}
+
+
+void accelerometer_get_event(accel_event_t event, uint8_t *threshold, uint8_t *count)
+{
+	*threshold = event_threshold[event];
+	*count = event_count[event];
+}
+
+
+accel_mode_t accelerometer_get_mode(void)
+{
+	return mode;
+}
+
+
+/**
+ * Output data rate in Hz, rounded down
+ */
+unsigned int accelerometer_get_rate(void)
+{
+	return odr_hz[odr >> 3];
+}
+
+
+/**
+ * Contents of WHO_AM_I read at init, ACCEL_WHO_AM_I_MMA845x
+ */
+uint8_t accelerometer_get_id(void)
+{
+	return who_am_i;
+}
+
+
+#ifdef ACCEL_USE_DRDY
+/**
+ * Data-ready interrupt. Starts a non-blocking read of the new sample.
+ */
+ISR(ACCEL_INT1_VECT)
+{
+	if(! i2c_in_progress(&drdy_read))
+		i2c_submit(&drdy_read);
+}
+#endif
+
+
+/**
+ * Event interrupt. Starts a non-blocking read of the event source registers.
+ */
+ISR(ACCEL_INT2_VECT)
+{
+	if(! i2c_in_progress(&event_read))
+		i2c_submit(&event_read);
 }
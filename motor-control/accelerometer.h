@@ -11,14 +11,35 @@
 
 #define ACCEL_TWI_ADDRESS							0x1d
 #define ACCEL_GSCALE								2		// +/- 2, 4, or 8 G's
+#define ACCEL_ODR									ACCEL_CTRL_REG1_DR_100HZ_bm
+#define ACCEL_USE_DRDY										// Comment out to poll from the sensor engine
+#define ACCEL_RING_SIZE								16		// Samples buffered for accelerometer_calibrate()
+#define ACCEL_FIFO_WATERMARK						8		// Samples per FIFO burst, MMA8451 only
+#define ACCEL_CAL_SAMPLES							64		// Default samples averaged by accelerometer_calibrate()
+#define ACCEL_CAL_TIMEOUT_MS						250		// Give up if no sample arrives for this long
+#define ACCEL_CAL_MAGIC								0xa5
+#define ACCEL_PULSE_LATENCY							40		// ODR periods after a pulse before the next can register
+
+/* INT1 carries data-ready, INT2 the motion, free-fall, transient and pulse
+ * engines. The MMA845x drives both push-pull, active low (the CTRL_REG3 defaults).
+ */
+#define ACCEL_INT_PORT								PORTB
+#define ACCEL_INT1_bm								PIN0_bm
+#define ACCEL_INT1_PINCTRL							PIN0CTRL
+#define ACCEL_INT1_VECT								PORTB_INT0_vect
+#define ACCEL_INT2_bm								PIN1_bm
+#define ACCEL_INT2_PINCTRL							PIN1CTRL
+#define ACCEL_INT2_VECT								PORTB_INT1_vect
 
 #define ACCEL_STATUS								0x00
+#define ACCEL_F_STATUS								0x00	// MMA8451 with the FIFO enabled
 #define ACCEL_OUT_X_MSB								0x01
 #define ACCEL_OUT_X_LSB								0x02
 #define ACCEL_OUT_Y_MSB								0x03
 #define ACCEL_OUT_Y_LSB								0x04
 #define ACCEL_OUT_Z_MSB								0x05
 #define ACCEL_OUT_Z_LSB								0x06
+#define ACCEL_F_SETUP								0x09	// MMA8451 only
 #define ACCEL_SYSMOD								0x0b
 #define ACCEL_INT_SOURCE							0x0c
 #define ACCEL_WHO_AM_I								0x0d
@@ -64,6 +85,20 @@
 #define ACCEL_STATUS_YDR_bm							(1<<1)
 #define ACCEL_STATUS_XDR_bm							(1<<0)
 
+#define ACCEL_F_STATUS_F_OVF_bm						(1<<7)
+#define ACCEL_F_STATUS_F_WMRK_FLAG_bm				(1<<6)
+#define ACCEL_F_STATUS_F_CNT_gm						(0x3f)
+
+#define ACCEL_F_SETUP_F_MODE_DISABLED_gc			(0<<6)
+#define ACCEL_F_SETUP_F_MODE_CIRCULAR_gc			(1<<6)
+#define ACCEL_F_SETUP_F_MODE_FILL_gc				(2<<6)
+#define ACCEL_F_SETUP_F_MODE_TRIGGER_gc				(3<<6)
+#define ACCEL_F_SETUP_F_WMRK_gm						(0x3f)
+
+#define ACCEL_WHO_AM_I_MMA8451						0x1a
+#define ACCEL_WHO_AM_I_MMA8452						0x2a
+#define ACCEL_WHO_AM_I_MMA8453						0x3a
+
 #define ACCEL_SYSMOD_STANDBY_bm						(0x00)
 #define ACCEL_SYSMOD_WAKE_bm						(0x01)
 #define ACCEL_SYSMOD_SLEEP_bm						(0x02)
@@ -182,6 +217,7 @@
 #define ACCEL_CTRL_REG3_PP_OD_bm					(1<<0)
 
 #define ACCEL_CTRL_REG4_INT_EN_ASLP_bm				(1<<7)
+#define ACCEL_CTRL_REG4_INT_EN_FIFO_bm				(1<<6)	// MMA8451 only
 #define ACCEL_CTRL_REG4_INT_EN_TRANS_bm				(1<<5)
 #define ACCEL_CTRL_REG4_INT_EN_LNDPRT_bm			(1<<4)
 #define ACCEL_CTRL_REG4_INT_EN_PULSE_bm				(1<<3)
@@ -189,6 +225,7 @@
 #define ACCEL_CTRL_REG4_INT_EN_DRDY_bm				(1<<0)
 
 #define ACCEL_CTRL_REG5_INT_CFG_ASLP_bm				(1<<7)
+#define ACCEL_CTRL_REG5_INT_CFG_FIFO_bm				(1<<6)	// MMA8451 only
 #define ACCEL_CTRL_REG5_INT_CFG_TRANS_bm			(1<<5)
 #define ACCEL_CTRL_REG5_INT_CFG_LNDPRT_bm			(1<<4)
 #define ACCEL_CTRL_REG5_INT_CFG_PULSE_bm			(1<<3)
@@ -199,13 +236,71 @@ typedef struct accelerometer_data {
 	short int x, y, z;
 } accelerometer_data_t;
 
+/**
+ * How samples are read. The fast modes set F_READ, which skips the LSB registers:
+ * each sample is three bytes of 8 bit data instead of six of 12 bit data. Fast
+ * samples are shifted up to the same scale as 12 bit ones.
+ */
+typedef enum accel_mode {
+	ACCEL_MODE_NORMAL,								// 12 bit, one read per data-ready
+	ACCEL_MODE_FAST,								// 8 bit, one read per data-ready
+	ACCEL_MODE_FIFO									// 8 bit, ACCEL_FIFO_WATERMARK samples per read
+} accel_mode_t;
+
+/**
+ * Embedded detection engines. Motion and free-fall share the FF_MT engine, so
+ * only one of them can be enabled at a time. Thresholds are in 0.063 g steps
+ * (0-127) and counts in ODR periods.
+ */
+typedef enum accel_event {
+	ACCEL_EVENT_MOTION,								// Any of X or Y above the threshold
+	ACCEL_EVENT_FREEFALL,							// All axes below the threshold
+	ACCEL_EVENT_TRANSIENT,							// High-passed X or Y above the threshold
+	ACCEL_EVENT_PULSE,								// A tap on any axis
+	ACCEL_NUM_EVENTS
+} accel_event_t;
+
+/**
+ * Zero-g offsets for the OFF_X/Y/Z registers, 2 mg per LSB whatever the scale
+ */
+typedef struct accel_cal {
+	int8_t offset[3];
+	uint8_t magic;									// ACCEL_CAL_MAGIC if the offsets are valid
+} accel_cal_t;
+
+typedef struct accel_sample {
+	accelerometer_data_t a;
+	unsigned long int time;							// tick_count when it was read
+} accel_sample_t;
+
+typedef struct accel_stats {
+	unsigned int samples;							// Samples read since boot
+	unsigned int dropped;							// Samples overwritten before they were popped
+	unsigned int rearms;							// Reads started by accelerometer_tick()
+	unsigned int bursts;							// Reads that returned at least one sample
+} accel_stats_t;
+
 
-void init_accelerometer(void);
+bool init_accelerometer(void);
 bool accelerometer_write_ram(uint8_t address, uint8_t data);
 bool accelerometer_read_ram(uint8_t address, uint8_t *rx_data);
 bool accelerometer_standby(void);
 bool accelerometer_active(void);
 bool accelerometer_get_data(accelerometer_data_t *a);
+void accelerometer_decode(const uint8_t *raw_data, accelerometer_data_t *a);
+bool accelerometer_pop_sample(accel_sample_t *s);
+uint8_t accelerometer_sample_count(void);
+void accelerometer_get_stats(accel_stats_t *stats);
+void accelerometer_tick(void);
+bool accelerometer_set_mode(accel_mode_t mode, unsigned int rate_hz);
+accel_mode_t accelerometer_get_mode(void);
+unsigned int accelerometer_get_rate(void);
+uint8_t accelerometer_get_id(void);
+bool accelerometer_calibrate(unsigned int samples);
+bool accelerometer_clear_calibration(void);
+void accelerometer_get_calibration(accel_cal_t *c);
+bool accelerometer_set_event(accel_event_t event, uint8_t threshold, uint8_t count);
+void accelerometer_get_event(accel_event_t event, uint8_t *threshold, uint8_t *count);
 
 
 #endif /* ACCELEROMETER_H_ */
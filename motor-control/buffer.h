@@ -64,6 +64,18 @@ inline int buffer_empty(buffer_t *buffer)
 }
 
 
+/**
+ * Number of bytes that can be added to a buffer before it is full
+ *
+ * @param buffer Pointer to a buffer_t struct
+ * @return Free space in bytes
+ */
+inline uint8_t buffer_free(buffer_t *buffer)
+{
+	return (buffer->size - 1) - ((buffer->tail + buffer->size - buffer->head) % buffer->size);
+}
+
+
 /**
  * Adds a byte to the buffer
  *
@@ -17,35 +17,41 @@
 
 uint8_t current_compass_addr = COMPASS_FLAT_TWI_ADDRESS;
 uint16_t compass_north = 0;
+static int last_bearing = 0;
 
-static inline void init_single_compass(void)
+static inline bool init_single_compass(void)
 {
-	/* Initialize compass state. Consider adding a timeout so we don't get stuck here. */
-	while(! compass_wakeup());
-	// Continuous mode, 20Hz update frequency
-	while(! compass_write_ram(COMPASS_RAM_OPMODE,
-			COMPASS_OPMODE_FREQ_20HZ | COMPASS_OPMODE_CONTINUOUS));
-	while(! compass_update_bridge_offsets());
-	while(! compass_write_eeprom(COMPASS_EEPROM_NUM_MEASUREMENTS, 4));
+	return I2C_RETRY(compass_wakeup())
+		// Continuous mode, 20Hz update frequency
+		&& I2C_RETRY(compass_write_ram(COMPASS_RAM_OPMODE,
+				COMPASS_OPMODE_FREQ_20HZ | COMPASS_OPMODE_CONTINUOUS))
+		&& I2C_RETRY(compass_update_bridge_offsets())
+		&& I2C_RETRY(compass_write_eeprom(COMPASS_EEPROM_NUM_MEASUREMENTS, 4));
 }
 
 
 /**
  * Initialize compass module.
+ *
+ * @return True if both compasses responded, otherwise false
  */
-void init_compass(void)
+bool init_compass(void)
 {
+	bool ramp_ok, flat_ok;
+
 	DEBUG_STATUS(DEBUG_INIT_COMPASS);
 
 	compass_set(COMPASS_RAMP);
-	init_single_compass();
+	ramp_ok = init_single_compass();
 	compass_set(COMPASS_FLAT);
-	init_single_compass();
+	flat_ok = init_single_compass();
 
 //	for(ms_timer = 0; ms_timer < (40/MS_TIMER_PER););	// Wait for compass to stabilize
-	while(! compass_read(&compass_north));
+	flat_ok = flat_ok && I2C_RETRY(compass_read(&compass_north));
 
 	DEBUG_CLEAR_STATUS();
+
+	return ramp_ok && flat_ok;
 }
 
 
@@ -242,19 +248,55 @@ void compass_set(compass_t compass)
 }
 
 
-int compass_get_bearing(void)
+/**
+ * Convert a raw heading from a compass to a bearing relative to compass_north.
+ * The ramp compass' mounting offset is applied by the fusion code in sensors.c.
+ *
+ * @param abs_heading Heading as read from the compass, tenths of a degree
+ * @return Bearing in tenths of a degree (0-3599)
+ */
+int compass_raw_to_bearing(uint16_t abs_heading)
+{
+	int bearing = abs_heading - compass_north;
+
+	while(bearing < 0)
+		bearing += 3600;
+
+	return bearing;
+}
+
+
+/**
+ * Read the current compass' bearing relative to compass_north.
+ *
+ * @param bearing Set to the bearing in tenths of a degree (0-3599), not corrected for
+ * 		  the ramp compass' offset. Left alone if the compass can't be read.
+ * @return True if the compass answered
+ */
+bool compass_try_bearing(int *bearing)
 {
 	uint16_t abs_heading;
-	int bearing;
 
-	while(! compass_read(&abs_heading));
-	bearing = abs_heading - compass_north;
+	if(! I2C_RETRY(compass_read(&abs_heading)))
+		return false;
 
-	if(current_compass_addr == COMPASS_RAMP_TWI_ADDRESS)
-		bearing -= 1800;
+	last_bearing = compass_raw_to_bearing(abs_heading);
+	*bearing = last_bearing;
+	return true;
+}
 
-	while(bearing < 0)
-		bearing += 3600;
 
+/**
+ * Read the current compass and return the bearing relative to compass_north.
+ *
+ * @return Bearing in tenths of a degree (0-3599), not corrected for the ramp compass'
+ * 		   offset. If the compass can't be read, the last good bearing is returned and
+ * 		   the failure shows up in i2c_stats.
+ */
+int compass_get_bearing(void)
+{
+	int bearing = last_bearing;
+
+	compass_try_bearing(&bearing);
 	return bearing;
 }
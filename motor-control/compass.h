@@ -13,6 +13,7 @@
 
 #define COMPASS_RAMP_TWI_ADDRESS		(0x42 >> 1)
 #define COMPASS_FLAT_TWI_ADDRESS		(0x40 >> 1)
+#define COMPASS_RAMP_OFFSET				1800	// Ramp compass reads 180 degrees off the flat one
 
 // Compass command bytes
 #define COMPASS_WRITE_EEPROM			'w'
@@ -64,7 +65,7 @@ typedef enum compass {
 	COMPASS_RAMP
 } compass_t;
 
-void init_compass(void);
+bool init_compass(void);
 bool compass_write_eeprom(uint8_t address, uint8_t data);
 bool compass_read_eeprom(uint8_t address, uint8_t *data);
 bool compass_write_ram(uint8_t address, uint8_t data);
@@ -78,6 +79,8 @@ bool compass_save_opmode(void);
 bool compass_get_data(uint16_t *data);
 bool compass_read(uint16_t *data);
 void compass_set(compass_t compass);
+int compass_raw_to_bearing(uint16_t abs_heading);
+bool compass_try_bearing(int *bearing);
 int compass_get_bearing(void);
 
 extern uint16_t compass_north;
@@ -0,0 +1,266 @@
+/*
+ * compass_cal.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+#include "fixmath.h"
+#include "compass.h"
+#include "compass_cal.h"
+
+static compass_cal_t EEMEM cal_eeprom[COMPASS_CAL_NUM_COMPASSES];
+static compass_cal_t cal[COMPASS_CAL_NUM_COMPASSES];
+static volatile compass_cal_progress_t progress[COMPASS_CAL_NUM_COMPASSES];
+static volatile bool collecting = false;
+
+
+/**
+ * Load saved calibrations from EEPROM. Call before init_sensors().
+ */
+void init_compass_cal(void)
+{
+	eeprom_read_block(cal, cal_eeprom, sizeof(cal));
+}
+
+
+/**
+ * True if the sensor engine should read raw X/Y from a compass rather than its
+ * heading output, i.e. while collecting or once a calibration is stored.
+ */
+bool compass_cal_raw_wanted(compass_t compass)
+{
+	return collecting || cal[compass].magic == COMPASS_CAL_MAGIC;
+}
+
+
+/**
+ * Record a raw sample. Called from the TWI interrupt.
+ */
+void compass_cal_sample(compass_t compass, int16_t x, int16_t y)
+{
+	volatile compass_cal_progress_t *p = &progress[compass];
+
+	if(! collecting)
+		return;
+
+	if(p->samples == 0)
+	{
+		p->min_x = p->max_x = x;
+		p->min_y = p->max_y = y;
+	}
+	else
+	{
+		if(x < p->min_x) p->min_x = x;
+		if(x > p->max_x) p->max_x = x;
+		if(y < p->min_y) p->min_y = y;
+		if(y > p->max_y) p->max_y = y;
+	}
+
+	if(p->samples < 0xffff)
+		p->samples++;
+}
+
+
+bool compass_cal_is_valid(compass_t compass)
+{
+	return cal[compass].magic == COMPASS_CAL_MAGIC;
+}
+
+
+/**
+ * Compute a heading from raw X/Y, corrected if a calibration is stored.
+ *
+ * @return Heading in tenths of a degree (0-3599), in the same sense as the
+ * 		   compass' own heading output
+ */
+int compass_cal_heading(compass_t compass, int16_t x, int16_t y)
+{
+	compass_cal_t *c = &cal[compass];
+	long cx = x, cy = y;
+
+	if(c->magic == COMPASS_CAL_MAGIC)
+	{
+		cx -= c->offset_x;
+		cy = ((cy - c->offset_y) * c->scale_y) >> 8;
+	}
+
+	/* Heading is measured from the X axis towards Y, like the compass' own output */
+	return fixmath_atan2(cy, cx);
+}
+
+
+/**
+ * Compute a tilt-compensated heading from calibrated raw X/Y and the accelerometer.
+ *
+ * The HMC6352 has no Z axis, so the vertical component is reconstructed from the
+ * field strength: the calibration circle gives the horizontal field, COMPASS_DIP
+ * gives the total, and Z is what is left after X and Y. The field is then rotated
+ * back to horizontal by the roll and pitch measured by the accelerometer. This
+ * assumes the accelerometer's X/Y axes are parallel to the compass' and Z points
+ * up; change the signs below if they are mounted differently. Valid up to
+ * 90 - COMPASS_DIP degrees of tilt, past which the field's Z component changes sign.
+ *
+ * The tilt_bench command reports what this costs per call.
+ *
+ * @return Heading in tenths of a degree (0-3599). Falls back to
+ * 		   compass_cal_heading() without a calibration or if the accelerometer
+ * 		   reading is unusable.
+ */
+int compass_cal_tilt_heading(compass_t compass,
+							 int16_t x,
+							 int16_t y,
+							 const accelerometer_data_t *a)
+{
+	compass_cal_t *c = &cal[compass];
+	long mx, my, mz, b2, xh, yh;
+	long ax = a->x, ay = a->y, az = a->z;
+	uint16_t r_yz, g, b;
+	int sin_roll, cos_roll, sin_pitch, cos_pitch;
+
+	r_yz = fixmath_isqrt(ay*ay + az*az);
+	g = fixmath_isqrt(ax*ax + ay*ay + az*az);
+
+	if(c->magic != COMPASS_CAL_MAGIC || r_yz == 0 || az <= 0)
+		return compass_cal_heading(compass, x, y);
+
+	mx = x - c->offset_x;
+	my = ((long)(y - c->offset_y) * c->scale_y) >> 8;
+
+	/* Total field = horizontal / cos(dip). Z points down in the northern hemisphere. */
+	b = ((unsigned long)c->radius * FIXMATH_ONE) / fixmath_cos(COMPASS_DIP);
+	b2 = (long)b * b - mx*mx - my*my;
+	mz = (b2 > 0) ? fixmath_isqrt(b2) : 0;
+
+	sin_roll = (ay * FIXMATH_ONE) / r_yz;
+	cos_roll = (az * FIXMATH_ONE) / r_yz;
+	sin_pitch = (-ax * FIXMATH_ONE) / g;
+	cos_pitch = ((long)r_yz * FIXMATH_ONE) / g;
+
+	xh = (mx * cos_pitch
+		  + ((my * sin_roll + mz * cos_roll) >> 14) * sin_pitch) >> 14;
+	yh = (my * cos_roll - mz * sin_roll) >> 14;
+
+	return fixmath_atan2(yh, xh);
+}
+
+
+/**
+ * Start collecting samples from both compasses. Spin the robot at least one full
+ * turn, then call compass_cal_stop().
+ */
+void compass_cal_start(void)
+{
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < COMPASS_CAL_NUM_COMPASSES; i++)
+			progress[i].samples = 0;
+		collecting = true;
+	}
+}
+
+
+/**
+ * Fit one compass from its extremes. Hard iron shifts the centre of the X/Y circle,
+ * soft iron stretches it into an ellipse; only the axis-aligned part of the stretch
+ * is corrected, which is what a min/max fit can see.
+ */
+static bool fit(compass_cal_t *c, compass_cal_progress_t *p)
+{
+	long span_x = (long)p->max_x - p->min_x;
+	long span_y = (long)p->max_y - p->min_y;
+
+	if(p->samples < COMPASS_CAL_MIN_SAMPLES
+			|| span_x < COMPASS_CAL_MIN_SPAN
+			|| span_y < COMPASS_CAL_MIN_SPAN)
+		return false;
+
+	c->offset_x = ((long)p->max_x + p->min_x) / 2;
+	c->offset_y = ((long)p->max_y + p->min_y) / 2;
+	c->scale_y = (span_x << 8) / span_y;
+	c->radius = span_x / 2;
+	c->magic = COMPASS_CAL_MAGIC;
+
+	return true;
+}
+
+
+/**
+ * Stop collecting, fit each compass that saw enough rotation and save the results.
+ * Compasses that didn't see enough rotation keep their previous calibration.
+ *
+ * @return Bitmask of compasses calibrated, (1 << COMPASS_FLAT) | (1 << COMPASS_RAMP)
+ */
+uint8_t compass_cal_stop(void)
+{
+	compass_cal_progress_t p;
+	compass_cal_t c;
+	uint8_t fitted = 0;
+	uint8_t i;
+
+	collecting = false;
+
+	for(i = 0; i < COMPASS_CAL_NUM_COMPASSES; i++)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			p = *(compass_cal_progress_t *)&progress[i];
+		}
+
+		if(fit(&c, &p))
+		{
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				cal[i] = c;
+			}
+			fitted |= 1 << i;
+		}
+	}
+
+	eeprom_update_block(cal, cal_eeprom, sizeof(cal));
+
+	return fitted;
+}
+
+
+/**
+ * Forget both calibrations and go back to the compasses' heading output
+ */
+void compass_cal_clear(void)
+{
+	uint8_t i;
+
+	collecting = false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < COMPASS_CAL_NUM_COMPASSES; i++)
+			cal[i].magic = 0;
+	}
+
+	eeprom_update_block(cal, cal_eeprom, sizeof(cal));
+}
+
+
+bool compass_cal_is_collecting(void)
+{
+	return collecting;
+}
+
+
+/**
+ * Copy the stored calibration and collection progress of one compass
+ */
+void compass_cal_get(compass_t compass, compass_cal_t *c, compass_cal_progress_t *p)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*c = cal[compass];
+		*p = *(compass_cal_progress_t *)&progress[compass];
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * compass_cal.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Hard- and soft-iron calibration for the compasses, done in firmware instead of
+ * with the HMC6352's own 20 s calibration mode. While collecting, the sensor engine
+ * reads raw X/Y from each compass and the extremes are tracked as the robot spins.
+ * Stopping fits a centre offset and a Y scale, saves them to EEPROM and from then on
+ * the heading is computed from corrected raw X/Y.
+ */
+
+#ifndef COMPASS_CAL_H_
+#define COMPASS_CAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "compass.h"
+#include "accelerometer.h"
+
+#define COMPASS_CAL_MAGIC			0xc6
+#define COMPASS_CAL_MIN_SAMPLES		20		// About 4 s of raw samples
+#define COMPASS_CAL_MIN_SPAN		64		// Smallest usable max - min on either axis
+#define COMPASS_CAL_NUM_COMPASSES	2		// Indexed by compass_t
+#define COMPASS_DIP					640		// Magnetic inclination where the robot runs, tenths of a degree
+
+typedef struct compass_cal {
+	int16_t offset_x;			// Hard-iron centre of the X/Y ellipse
+	int16_t offset_y;
+	uint16_t scale_y;			// Soft-iron: Y is scaled to match X, Q8.8
+	uint16_t radius;			// Horizontal field strength, raw X units
+	uint8_t magic;				// COMPASS_CAL_MAGIC if the calibration is valid
+} compass_cal_t;
+
+typedef struct compass_cal_progress {
+	int16_t min_x, max_x;
+	int16_t min_y, max_y;
+	unsigned int samples;
+} compass_cal_progress_t;
+
+void init_compass_cal(void);
+bool compass_cal_raw_wanted(compass_t compass);
+void compass_cal_sample(compass_t compass, int16_t x, int16_t y);
+int compass_cal_heading(compass_t compass, int16_t x, int16_t y);
+int compass_cal_tilt_heading(compass_t compass, int16_t x, int16_t y, const accelerometer_data_t *a);
+bool compass_cal_is_valid(compass_t compass);
+void compass_cal_start(void);
+uint8_t compass_cal_stop(void);
+void compass_cal_clear(void);
+bool compass_cal_is_collecting(void);
+void compass_cal_get(compass_t compass, compass_cal_t *cal, compass_cal_progress_t *progress);
+
+#endif /* COMPASS_CAL_H_ */
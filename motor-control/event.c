@@ -0,0 +1,137 @@
+/*
+ * event.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "SerialCommands.h"
+#include "buffer.h"
+#include "uart.h"
+#include "timer.h"
+#include "json.h"
+#include "sensors.h"
+#include "event.h"
+
+typedef struct event {
+	event_type_t type;
+	int src;
+	int value;
+	unsigned long int time;
+} event_t;
+
+static const char *event_names[EVENT_NUM_TYPES] = {
+	"motion",
+	"freefall",
+	"transient",
+	"pulse",
+	"obstacle",
+	"drop",
+	"servo"
+};
+
+/* Key for each type's extra reading, NULL if it has none */
+static const char *value_names[EVENT_NUM_TYPES] = {
+	[EVENT_DROP] = "floor",
+	[EVENT_SERVO] = "angle"
+};
+
+static volatile event_t queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0, queue_tail = 0;
+static volatile unsigned int dropped = 0;
+
+
+/**
+ * Queue an event for the host. Safe to call from any interrupt.
+ *
+ * @param type Event type
+ * @param src Event specific detail
+ * @return True if queued, false if the queue was full
+ */
+bool event_post(event_type_t type, int src)
+{
+	return event_post_value(type, src, 0);
+}
+
+
+/**
+ * Queue an event with an extra reading, printed under the type's key in
+ * value_names. Safe to call from any interrupt.
+ *
+ * @param type Event type
+ * @param src Event specific detail
+ * @param value Extra reading
+ * @return True if queued, false if the queue was full
+ */
+bool event_post_value(event_type_t type, int src, int value)
+{
+	uint8_t next;
+	bool queued = false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		next = (queue_tail + 1) % EVENT_QUEUE_SIZE;
+		if(next == queue_head)
+		{
+			dropped++;
+		}
+		else
+		{
+			queue[queue_tail].type = type;
+			queue[queue_tail].src = src;
+			queue[queue_tail].value = value;
+			queue[queue_tail].time = tick_count;
+			queue_tail = next;
+			queued = true;
+		}
+	}
+
+	return queued;
+}
+
+
+/**
+ * Print the oldest queued event. Called every MS_TIMER tick, after the PID loop
+ * has had its chance to respond.
+ *
+ * printf() waits for room in the TX buffer, which would stall the tick, so an
+ * event is only printed once the whole line fits; until then it waits for a
+ * later tick.
+ */
+void event_tick(void)
+{
+	event_t e;
+
+	if(queue_head == queue_tail || json_in_response()
+	   || buffer_free(&debug_uart.write_buffer) < EVENT_LINE_MAX)
+		return;
+
+	e = *(event_t *)&queue[queue_head];
+	queue_head = (queue_head + 1) % EVENT_QUEUE_SIZE;
+
+	json_start_response(true, event_names[e.type], ASYNC_RESP_ID);
+	json_add_int("src", e.src);
+	if(value_names[e.type] != NULL)
+		json_add_int(value_names[e.type], e.value);
+	json_add_int("age", sensors_age_ms(e.time));
+	json_end_response();
+}
+
+
+/**
+ * Number of events lost because the queue was full
+ */
+unsigned int event_get_dropped(void)
+{
+	unsigned int d;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		d = dropped;
+	}
+
+	return d;
+}
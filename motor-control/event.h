@@ -0,0 +1,45 @@
+/*
+ * event.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Asynchronous events for the host. Interrupt handlers post events here, and the
+ * MS_TIMER interrupt prints them as JSON lines with id ASYNC_RESP_ID, e.g.
+ *
+ *     {"result":true,"msg":"motion","id":5,"src":10,"age":0}
+ *
+ * "msg" names the event, "src" is event specific (the accelerometer's source
+ * register for accelerometer events, the distance in mm for "obstacle" and
+ * "drop", the channel for "servo") and "age" is how many ms ago it was posted.
+ * Some events carry one more reading, e.g. "floor" for "drop" and "angle" for
+ * "servo".
+ * Events are never printed in the middle of another JSON response, and at most one
+ * is printed per tick, when the TX buffer has room for it, so they may be late.
+ */
+
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EVENT_QUEUE_SIZE		8
+#define EVENT_LINE_MAX			96		// Longest event line, with every field at its widest
+
+typedef enum event_type {
+	EVENT_MOTION,
+	EVENT_FREEFALL,
+	EVENT_TRANSIENT,
+	EVENT_PULSE,
+	EVENT_OBSTACLE,
+	EVENT_DROP,
+	EVENT_SERVO,
+	EVENT_NUM_TYPES
+} event_type_t;
+
+bool event_post(event_type_t type, int src);
+bool event_post_value(event_type_t type, int src, int value);
+void event_tick(void);
+unsigned int event_get_dropped(void);
+
+#endif /* EVENT_H_ */
@@ -0,0 +1,170 @@
+/*
+ * fixmath.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "fixmath.h"
+
+#define ATAN_TABLE_BITS		5		// 33 entries, tan = 0 to 1 in steps of 1/32
+#define SIN_TABLE_STEP		30		// Tenths of a degree between sin_table entries
+
+/**
+ * atan(i/32) in hundredths of a degree
+ */
+static const int16_t atan_table[(1 << ATAN_TABLE_BITS) + 1] = {
+	0, 179, 358, 536, 713, 888, 1062, 1234, 1404, 1571, 1735, 1897, 2056, 2211, 2363, 2511, 2657,
+	2798, 2936, 3070, 3201, 3327, 3451, 3571, 3687, 3800, 3909, 4016, 4119, 4218, 4315, 4409, 4500
+};
+
+
+/**
+ * sin of 0 to 90 degrees in steps of 3 degrees, Q14
+ */
+static const int16_t sin_table[900 / SIN_TABLE_STEP + 1] = {
+	0, 857, 1713, 2563, 3406, 4240, 5063, 5872, 6664, 7438, 8192, 8923, 9630, 10311, 10963, 11585,
+	12176, 12733, 13255, 13741, 14189, 14598, 14968, 15296, 15582, 15826, 16026, 16182, 16294, 16362,
+	16384
+};
+
+
+/**
+ * atan of num/den for 0 <= num <= den, in hundredths of a degree (0-4500)
+ */
+static int atan_octant(unsigned long num, unsigned long den)
+{
+	unsigned int ratio;
+	uint8_t index, frac;
+
+	if(den == 0)
+		return 0;
+
+	/* Scale down so that num << 11 can't overflow */
+	while(den > 0xfffffUL)
+	{
+		num >>= 1;
+		den >>= 1;
+	}
+
+	ratio = (num << 11) / den;						// tan in Q11, 0 to 2048
+	index = ratio >> (11 - ATAN_TABLE_BITS);
+	frac = ratio & ((1 << (11 - ATAN_TABLE_BITS)) - 1);
+
+	if(index >= (1 << ATAN_TABLE_BITS))
+		return atan_table[1 << ATAN_TABLE_BITS];
+
+	return atan_table[index]
+		   + (((long)(atan_table[index+1] - atan_table[index]) * frac) >> (11 - ATAN_TABLE_BITS));
+}
+
+
+/**
+ * Four-quadrant arctangent.
+ *
+ * Table lookup with linear interpolation; the result is within 0.1 degree of the
+ * exact value for any inputs up to +/-2^24.
+ *
+ * @param y Y component
+ * @param x X component
+ * @return Angle from the +X axis towards +Y, in tenths of a degree (0-3599). 0 if
+ * 		   both components are 0.
+ */
+int fixmath_atan2(long y, long x)
+{
+	unsigned long ax = labs(x);
+	unsigned long ay = labs(y);
+	int a;
+
+	if(ax >= ay)
+		a = atan_octant(ay, ax);
+	else
+		a = 9000 - atan_octant(ax, ay);
+
+	a = (a + 5) / 10;								// Hundredths to tenths, rounded
+
+	if(x < 0)
+		a = 1800 - a;
+	if(y < 0)
+		a = 3600 - a;
+	if(a >= 3600)
+		a -= 3600;
+
+	return a;
+}
+
+
+/**
+ * Sine, by quarter-wave table lookup with linear interpolation. The result is
+ * within 7 LSB (0.0004) of the exact value.
+ *
+ * @param angle Angle in tenths of a degree, any value
+ * @return sin(angle) in Q14, -FIXMATH_ONE to FIXMATH_ONE
+ */
+int fixmath_sin(int angle)
+{
+	bool negative = false;
+	uint8_t index;
+	uint8_t frac;
+	int s;
+
+	angle %= 3600;
+	if(angle < 0)
+		angle += 3600;
+
+	if(angle >= 1800)
+	{
+		angle -= 1800;
+		negative = true;
+	}
+	if(angle > 900)
+		angle = 1800 - angle;
+
+	index = angle / SIN_TABLE_STEP;
+	frac = angle % SIN_TABLE_STEP;
+	s = sin_table[index];
+	if(frac)
+		s += ((long)(sin_table[index+1] - s) * frac) / SIN_TABLE_STEP;
+
+	return negative ? -s : s;
+}
+
+
+/**
+ * Cosine, see fixmath_sin(). Same table and error bound.
+ */
+int fixmath_cos(int angle)
+{
+	return fixmath_sin(angle % 3600 + 900);
+}
+
+
+/**
+ * Integer square root, rounded down. Bit-by-bit, 16 iterations, no multiplies.
+ * Exact for any 32-bit input: the result r always has r^2 <= x < (r+1)^2.
+ */
+uint16_t fixmath_isqrt(unsigned long x)
+{
+	unsigned long root = 0;
+	unsigned long bit = 1UL << 30;
+
+	while(bit > x)
+		bit >>= 2;
+
+	while(bit)
+	{
+		if(x >= root + bit)
+		{
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
@@ -0,0 +1,24 @@
+/*
+ * fixmath.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Integer trig for the compass tilt compensation and odometry. Angles are in
+ * tenths of a degree, the same units the compasses and the PID loop use. Each
+ * function's error bound is given where it is defined; the math_bench command
+ * times them against the float versions.
+ */
+
+#ifndef FIXMATH_H_
+#define FIXMATH_H_
+
+#include <stdint.h>
+
+#define FIXMATH_ONE			16384	// 1.0 in the Q14 format returned by sin/cos
+
+int fixmath_atan2(long y, long x);
+int fixmath_sin(int angle);
+int fixmath_cos(int angle);
+uint16_t fixmath_isqrt(unsigned long x);
+
+#endif /* FIXMATH_H_ */
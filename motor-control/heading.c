@@ -0,0 +1,149 @@
+/*
+ * heading.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+#include "motor.h"
+#include "sensors.h"
+#include "heading.h"
+
+#define FULL_TURN		(3600L << HEADING_FRAC_BITS)
+#define HALF_TURN		(1800L << HEADING_FRAC_BITS)
+
+static volatile long estimate;					// Tenths of a degree << HEADING_FRAC_BITS
+static long tick_scale;							// Estimate units per encoder tick of difference
+static unsigned int ticks_per_turn = HEADING_TICKS_PER_TURN;
+static uint8_t gain = HEADING_FILTER_GAIN;
+static unsigned long int left_count, right_count;
+static unsigned long int compass_time;
+static bool seeded;								// The estimate has had a real compass bearing
+static bool running = false;
+
+
+static inline long wrap(long heading)
+{
+	if(heading >= FULL_TURN)
+		heading -= FULL_TURN;
+	else if(heading < 0)
+		heading += FULL_TURN;
+
+	return heading;
+}
+
+
+/**
+ * Start the estimator from the current compass bearing. Call after init_sensors().
+ * If no compass has answered yet, the estimate jumps to the first bearing that
+ * arrives instead of being pulled towards it from 0.
+ */
+void init_heading(void)
+{
+	estimate = (long)sensors_get_heading_sample(&compass_time) << HEADING_FRAC_BITS;
+	seeded = (compass_time != 0);
+	heading_set_constants(ticks_per_turn, gain);
+	running = true;
+}
+
+
+/**
+ * Advance the estimate by one MS_TIMER tick. Called from the MS_TIMER interrupt
+ * before the PID iteration, whether or not the PID loop is running.
+ */
+void heading_tick(void)
+{
+	unsigned long int time;
+	int compass;
+	int left, right;
+	long e, error;
+
+	if(! running)
+		return;
+
+#if NUM_MOTORS == 2
+	left = motor_encoder_delta(&MOTOR_LEFT, &left_count);
+	right = motor_encoder_delta(&MOTOR_RIGHT, &right_count);
+#elif NUM_MOTORS == 4
+	left = motor_encoder_delta(&MOTOR_LEFT_FRONT, &left_count);
+	right = motor_encoder_delta(&MOTOR_RIGHT_FRONT, &right_count);
+#endif
+
+	/* Left wheel ahead of the right one turns the robot clockwise, i.e. towards a
+	 * larger bearing.
+	 */
+	e = wrap(estimate + (long)(left - right) * tick_scale);
+
+	compass = sensors_get_heading_sample(&time);
+	if(time != compass_time)
+	{
+		compass_time = time;
+
+		if(! seeded)
+		{
+			e = (long)compass << HEADING_FRAC_BITS;
+			seeded = true;
+		}
+		else
+		{
+			error = ((long)compass << HEADING_FRAC_BITS) - e;
+			if(error > HALF_TURN)
+				error -= FULL_TURN;
+			else if(error < -HALF_TURN)
+				error += FULL_TURN;
+
+			e = wrap(e + ((error * gain) >> 8));
+		}
+	}
+
+	estimate = e;
+}
+
+
+/**
+ * Returns the current heading estimate, in tenths of a degree (0-3599)
+ */
+int heading_get_estimate(void)
+{
+	long e;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		e = estimate;
+	}
+
+	return e >> HEADING_FRAC_BITS;
+}
+
+
+/**
+ * Change the estimator constants
+ *
+ * @param new_ticks_per_turn Left minus right encoder ticks for one full turn, or 0 to
+ * 		  ignore the encoders and follow the compass alone
+ * @param new_gain Fraction of the compass error corrected per compass sample, out of
+ * 		  256. 0 ignores the compass entirely.
+ */
+void heading_set_constants(unsigned int new_ticks_per_turn, uint8_t new_gain)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks_per_turn = new_ticks_per_turn;
+		gain = new_gain;
+		tick_scale = new_ticks_per_turn ? FULL_TURN / new_ticks_per_turn : 0;
+	}
+}
+
+
+unsigned int heading_get_ticks_per_turn(void)
+{
+	return ticks_per_turn;
+}
+
+
+uint8_t heading_get_gain(void)
+{
+	return gain;
+}
@@ -0,0 +1,28 @@
+/*
+ * heading.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Heading estimator for the PID loop. The compasses only update at 20 Hz (slower
+ * when calibrated), so every MS_TIMER tick the estimate is advanced by the
+ * difference in left and right encoder ticks, and each new compass bearing pulls
+ * it back with a complementary filter.
+ */
+
+#ifndef HEADING_H_
+#define HEADING_H_
+
+#include <stdint.h>
+
+#define HEADING_FRAC_BITS			8		// Estimate is kept in tenths of a degree << 8
+#define HEADING_TICKS_PER_TURN		1800	// Left minus right encoder ticks for one turn in place
+#define HEADING_FILTER_GAIN			64		// Fraction of the compass error applied per sample, /256
+
+void init_heading(void);
+void heading_tick(void);
+int heading_get_estimate(void);
+void heading_set_constants(unsigned int ticks_per_turn, uint8_t gain);
+unsigned int heading_get_ticks_per_turn(void);
+uint8_t heading_get_gain(void);
+
+#endif /* HEADING_H_ */
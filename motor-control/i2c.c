@@ -8,7 +8,9 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include "clock.h"
 #include "debug.h"
 #include "twi_master_driver.h"
@@ -17,6 +19,21 @@
 
 TWI_Master_t twi;
 
+/* Transactions waiting for the bus. The one on the bus has already been removed
+ * from the queue and is pointed to by current_transaction.
+ */
+static i2c_transaction_t * volatile queue[I2C_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
+static i2c_transaction_t * volatile current_transaction = NULL;
+static volatile uint8_t current_age = 0;		// MS_TIMER ticks since current_transaction started
+
+i2c_device_stats_t i2c_stats[I2C_MAX_DEVICES];
+unsigned int i2c_bus_recoveries = 0;
+
+/* Half an SCL period at I2C_TWI_FREQ, for bit-banging the recovery sequence */
+#define HALF_CLOCK_DELAY()		__builtin_avr_delay_cycles(CPU_SPEED_HZ / (2 * I2C_TWI_FREQ))
+
 
 /**
  * Initialize the I2C bus
@@ -32,6 +49,10 @@ void init_i2c(void)
 				   TWI_MASTER_INTLVL_MED_gc,
 				   TWI_BAUD(CPU_SPEED_HZ, I2C_TWI_FREQ));
 
+	// A slave left mid-transfer by a reset can hold SDA low forever
+	if(! (I2C_TWI_PORT.IN & I2C_SDA_bm))
+		i2c_recover_bus();
+
 	// Enable medium priority interrupts
 	PMIC.CTRL |= PMIC_MEDLVLEN_bm;
 	sei();
@@ -39,7 +60,218 @@ void init_i2c(void)
 
 
 /**
- * Function to send/receive data over the I2C bus.
+ * Free a bus that a slave is holding, then restart the TWI master.
+ *
+ * A slave that lost track of a read (e.g. across a reset) keeps SDA low waiting
+ * for clocks that never come. Up to nine SCL pulses let it finish the byte and
+ * see a NACK, after which a STOP returns the bus to idle. The lines are driven
+ * open-drain style: low by setting the pin as an output, high by releasing it.
+ */
+void i2c_recover_bus(void)
+{
+	uint8_t i;
+
+	I2C_TWI.MASTER.CTRLA = 0;				// Hand the pins back to the port
+	I2C_TWI_PORT.OUTCLR = I2C_SDA_bm | I2C_SCL_bm;
+	I2C_TWI_PORT.DIRCLR = I2C_SDA_bm | I2C_SCL_bm;
+
+	for(i=0; i<9 && ! (I2C_TWI_PORT.IN & I2C_SDA_bm); i++)
+	{
+		I2C_TWI_PORT.DIRSET = I2C_SCL_bm;
+		HALF_CLOCK_DELAY();
+		I2C_TWI_PORT.DIRCLR = I2C_SCL_bm;
+		HALF_CLOCK_DELAY();
+	}
+
+	// STOP condition: SDA rises while SCL is high
+	I2C_TWI_PORT.DIRSET = I2C_SCL_bm;
+	I2C_TWI_PORT.DIRSET = I2C_SDA_bm;
+	HALF_CLOCK_DELAY();
+	I2C_TWI_PORT.DIRCLR = I2C_SCL_bm;
+	HALF_CLOCK_DELAY();
+	I2C_TWI_PORT.DIRCLR = I2C_SDA_bm;
+	HALF_CLOCK_DELAY();
+
+	TWI_MasterInit(&twi,
+				   &I2C_TWI,
+				   TWI_MASTER_INTLVL_MED_gc,
+				   TWI_BAUD(CPU_SPEED_HZ, I2C_TWI_FREQ));
+	twi.status = TWIM_STATUS_READY;
+
+	i2c_bus_recoveries++;
+}
+
+
+/**
+ * Find the stats entry for an address, claiming a free one if necessary.
+ *
+ * @return Pointer into i2c_stats, or NULL if the table is full
+ */
+static i2c_device_stats_t *get_stats(uint8_t address)
+{
+	uint8_t i;
+
+	for(i=0; i<I2C_MAX_DEVICES; i++)
+	{
+		if(i2c_stats[i].address == address)
+			return &i2c_stats[i];
+
+		if(i2c_stats[i].transactions == 0)
+		{
+			i2c_stats[i].address = address;
+			return &i2c_stats[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Finish a transaction: copy out the received data, record the result and run
+ * the completion callback.
+ */
+static void finish_transaction(i2c_transaction_t *t, uint8_t result, i2c_status_t status)
+{
+	i2c_device_stats_t *stats = get_stats(t->address);
+	uint8_t i;
+
+	if(status == I2C_STATUS_OK)
+	{
+		for(i=0; i<t->rx_bytes; i++)
+			t->rx_data[i] = twi.readData[i];
+	}
+
+	if(stats != NULL)
+	{
+		stats->transactions++;
+		if(status == I2C_STATUS_TIMEOUT)
+			stats->timeouts++;
+		else if(result == TWIM_RESULT_NACK_RECEIVED)
+			stats->nacks++;
+		else if(result == TWIM_RESULT_BUS_ERROR || result == TWIM_RESULT_ARBITRATION_LOST)
+			stats->bus_errors++;
+	}
+
+	t->result = result;
+	t->status = status;
+
+	if(t->callback != NULL)
+		t->callback(t);
+}
+
+
+/**
+ * Put the next queued transaction on the bus, if the bus is free. Must be called
+ * with interrupts disabled or from the TWI interrupt.
+ */
+static void start_next_transaction(void)
+{
+	i2c_transaction_t *t;
+
+	while(current_transaction == NULL && queue_head != queue_tail)
+	{
+		t = queue[queue_head];
+		queue_head = (queue_head + 1) % I2C_QUEUE_SIZE;
+
+		if(TWI_MasterWriteRead(&twi, t->address, t->tx_data, t->tx_bytes, t->rx_bytes))
+		{
+			t->status = I2C_STATUS_BUSY;
+			current_age = 0;
+			current_transaction = t;
+		}
+		else
+		{
+			// Too many bytes for the driver buffers
+			finish_transaction(t, TWIM_RESULT_FAIL, I2C_STATUS_FAILED);
+		}
+	}
+}
+
+
+/**
+ * Give up on the transaction on the bus, reset the bus, and move on to the next
+ * one. Must be called with interrupts disabled.
+ */
+static void abort_current_transaction(void)
+{
+	i2c_transaction_t *t = current_transaction;
+
+	if(t != NULL)
+	{
+		current_transaction = NULL;
+		i2c_recover_bus();
+		finish_transaction(t, TWIM_RESULT_FAIL, I2C_STATUS_TIMEOUT);
+		start_next_transaction();
+	}
+}
+
+
+/**
+ * Queue a transaction. It is started right away if the bus is idle, otherwise
+ * the TWI interrupt starts it as soon as the transactions ahead of it finish.
+ *
+ * May be called from interrupts, including from a completion callback.
+ *
+ * @param t Transaction descriptor
+ * @return True if queued, or false if the queue is full or t is already queued
+ */
+bool i2c_submit(i2c_transaction_t *t)
+{
+	bool queued = false;
+	uint8_t next_tail;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		next_tail = (queue_tail + 1) % I2C_QUEUE_SIZE;
+
+		if(next_tail != queue_head && ! i2c_in_progress(t))
+		{
+			t->status = I2C_STATUS_QUEUED;
+			queue[queue_tail] = t;
+			queue_tail = next_tail;
+			queued = true;
+
+			start_next_transaction();
+		}
+	}
+
+	return queued;
+}
+
+
+/**
+ * @param t Transaction descriptor
+ * @return True if t is waiting for or using the bus
+ */
+bool i2c_in_progress(i2c_transaction_t *t)
+{
+	return t->status == I2C_STATUS_QUEUED || t->status == I2C_STATUS_BUSY;
+}
+
+
+/**
+ * Called every MS_TIMER tick to time out transactions started with i2c_submit().
+ */
+void i2c_tick(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(current_transaction != NULL && ++current_age >= I2C_TIMEOUT_TICKS)
+			abort_current_transaction();
+	}
+}
+
+
+/**
+ * Function to send/receive data over the I2C bus. Blocks until the transaction,
+ * and any queued ahead of it, have finished. Don't call this from a completion
+ * callback.
+ *
+ * The wait keeps its own clock rather than relying on i2c_tick(), since this is
+ * also called from the MS_TIMER interrupt, where the tick can't advance. Each
+ * transaction ahead of ours gets I2C_TIMEOUT_MS, so the wait is bounded by
+ * I2C_QUEUE_SIZE timeouts.
  *
  * @param address I2C address to use, not including the send/receive bit
  * @param rx_bytes Number of bytes to receive
@@ -54,32 +286,69 @@ bool i2c_send_receive(uint8_t address,
 				  	  uint8_t *rx_data,
 				  	  uint8_t *tx_data)
 {
-	int i;
+	i2c_transaction_t t;
+	i2c_transaction_t *waiting_on = NULL;
+	unsigned int waited_us = 0;
+
+	t.address = address;
+	t.tx_bytes = tx_bytes;
+	t.rx_bytes = rx_bytes;
+	t.tx_data = tx_data;
+	t.rx_data = rx_data;
+	t.callback = NULL;
+	t.context = NULL;
+	t.status = I2C_STATUS_IDLE;
+
+	if(! i2c_submit(&t))
+		return false;
 
-	if(TWI_MasterWriteRead(&twi,
-						   address,
-						   tx_data,
-						   tx_bytes,
-						   rx_bytes))
+	while(i2c_in_progress(&t))
 	{
-		while(twi.status != TWIM_STATUS_READY);
+		__builtin_avr_delay_cycles(CPU_SPEED_HZ / 100000);		// 10 us
 
-		if(twi.result == TWIM_RESULT_OK)
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			for(i=0; i<rx_bytes; i++)
-				rx_data[i] = twi.readData[i];
-
-			return true;
+			if(current_transaction != waiting_on)
+			{
+				waiting_on = current_transaction;
+				waited_us = 0;
+			}
+			else if((waited_us += 10) >= I2C_TIMEOUT_MS * 1000u)
+			{
+				abort_current_transaction();
+			}
 		}
 	}
 
-	return false;
+	return t.status == I2C_STATUS_OK;
 }
 
 
+/**
+ * Runs the TWI driver state machine, and when a transaction finishes, chains the
+ * next one so the bus never sits idle while work is queued.
+ */
 ISR(I2C_TWI_VECT)
 {
+	i2c_transaction_t *t;
+
 	DEBUG_ENTER_ISR(DEBUG_ISR_I2C);
 	TWI_MasterInterruptHandler(&twi);
+
+	t = current_transaction;
+	if(t != NULL && twi.status == TWIM_STATUS_READY)
+	{
+		current_transaction = NULL;
+
+		// The master can't clear a bus it has lost track of by itself
+		if(twi.result == TWIM_RESULT_BUS_ERROR || twi.result == TWIM_RESULT_ARBITRATION_LOST)
+			i2c_recover_bus();
+
+		finish_transaction(t,
+						   twi.result,
+						   (twi.result == TWIM_RESULT_OK) ? I2C_STATUS_OK : I2C_STATUS_FAILED);
+		start_next_transaction();
+	}
+
 	DEBUG_EXIT_ISR(DEBUG_ISR_I2C);
 }
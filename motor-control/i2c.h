@@ -10,13 +10,77 @@
 
 #include <avr/io.h>
 #include <stdbool.h>
+#include "timer.h"
 
 #define I2C_TWI_PORT			PORTC
 #define I2C_TWI					TWIC
 #define I2C_TWI_FREQ			100000
 #define I2C_TWI_VECT			TWIC_TWIM_vect
+#define I2C_QUEUE_SIZE			8		// One slot is always free, so 7 transactions can wait
+#define I2C_SDA_bm				PIN0_bm
+#define I2C_SCL_bm				PIN1_bm
+#define I2C_TIMEOUT_MS			20		// Longest transaction is ~1.5 ms at 100 kHz
+#define I2C_TIMEOUT_TICKS		(I2C_TIMEOUT_MS/MS_TIMER_PER)
+#define I2C_MAX_RETRIES			3
+#define I2C_MAX_DEVICES			4		// Accelerometer, two compasses and a spare
+
+typedef enum i2c_status {
+	I2C_STATUS_IDLE,		// Never submitted
+	I2C_STATUS_QUEUED,		// Waiting for the bus
+	I2C_STATUS_BUSY,		// On the bus now
+	I2C_STATUS_OK,
+	I2C_STATUS_FAILED,		// NACK, bus error or lost arbitration; see result
+	I2C_STATUS_TIMEOUT		// Aborted after I2C_TIMEOUT_MS, bus was reset
+} i2c_status_t;
+
+struct i2c_transaction;
+typedef void (*i2c_callback_t)(struct i2c_transaction *t);
+
+/**
+ * Descriptor for one write/read transaction. The caller owns the descriptor and
+ * both buffers, and they must stay valid until the transaction has completed.
+ */
+typedef struct i2c_transaction {
+	uint8_t address;				// I2C address, not including the send/receive bit
+	uint8_t tx_bytes;				// Bytes to write, then...
+	uint8_t rx_bytes;				// ...bytes to read after a repeated start
+	uint8_t *tx_data;
+	uint8_t *rx_data;
+	i2c_callback_t callback;		// Called from the TWI interrupt on completion, may be NULL
+	void *context;					// Free for the owner of the callback
+	volatile i2c_status_t status;
+	uint8_t result;					// TWIM_RESULT_t of the last run
+} i2c_transaction_t;
+
+/**
+ * Error counters for one slave address
+ */
+typedef struct i2c_device_stats {
+	uint8_t address;
+	unsigned int transactions;
+	unsigned int nacks;
+	unsigned int bus_errors;		// Bus errors and lost arbitration
+	unsigned int timeouts;
+} i2c_device_stats_t;
+
+/**
+ * Evaluate a driver call returning bool until it succeeds, at most I2C_MAX_RETRIES
+ * times. Each attempt is bounded by the transaction timeout, so this replaces the
+ * old "while(! compass_wakeup());" loops that hung the board if a slave was missing.
+ */
+#define I2C_RETRY(call)			({ uint8_t _tries = I2C_MAX_RETRIES; \
+								   bool _ok; \
+								   while(! (_ok = (call)) && --_tries); \
+								   _ok; })
+
+extern i2c_device_stats_t i2c_stats[I2C_MAX_DEVICES];
+extern unsigned int i2c_bus_recoveries;
 
 void init_i2c(void);
+void i2c_tick(void);
+void i2c_recover_bus(void);
+bool i2c_submit(i2c_transaction_t *t);
+bool i2c_in_progress(i2c_transaction_t *t);
 bool i2c_send_receive(uint8_t address,
 				  	  uint8_t rx_bytes,
 				  	  uint8_t tx_bytes,
@@ -15,6 +15,11 @@ const char *json_true = "true";
 const char *json_false = "false";
 const char *json_null = "null";
 
+/* Set between json_start_response() and json_end_response() so event_tick()
+ * doesn't print into the middle of a response
+ */
+static volatile bool in_response = false;
+
 /* in serial_interactive.c */
 extern bool interactive_mode;
 extern const char *lf;
@@ -28,30 +33,34 @@ void json_start_response(bool result, const char *msg, int id)
 	/* Why? to keep a JSON response from being printed in the PID controller interrupt while
 	 * another one is being printed in serial_interactive.c
 	 */
-	bool pid_enabled = pid_is_enabled();
-
-	if(pid_enabled) pid_disable();
+	pid_pause();
+	in_response = true;
 	printf("{\"result\":%s,\"msg\":\"%s\",\"id\":%d", result_str, msg, id);
-	if(pid_enabled) pid_enable();
+	pid_resume();
 }
 
 
 void json_add_int(const char *key, int val)
 {
-	bool pid_enabled = pid_is_enabled();
-
-	if(pid_enabled) pid_disable();
+	pid_pause();
 	printf(",\"%s\":%d", key, val);
-	if(pid_enabled) pid_enable();
+	pid_resume();
+}
+
+
+void json_add_long(const char *key, long val)
+{
+	pid_pause();
+	printf(",\"%s\":%ld", key, val);
+	pid_resume();
 }
 
 
 void json_add_object(const char *key, json_kv_t *kv_pairs, uint8_t len)
 {
 	uint8_t i;
-	bool pid_enabled = pid_is_enabled();
 
-	if(pid_enabled) pid_disable();
+	pid_pause();
 	printf(",\"%s\":{", key);
 	for(i=0; i<len; i++)
 	{
@@ -60,18 +69,24 @@ void json_add_object(const char *key, json_kv_t *kv_pairs, uint8_t len)
 		printf("\"%s\":%d", kv_pairs[i].key, kv_pairs[i].value);
 	}
 	printf("}");
-	if(pid_enabled) pid_enable();
+	pid_resume();
 }
 
 
 void json_end_response(void)
 {
 	const char *newline = interactive_mode ? crlf : lf;
-	bool pid_enabled = pid_is_enabled();
 
-	if(pid_enabled) pid_disable();
+	pid_pause();
 	printf("}%s", newline);
-	if(pid_enabled) pid_enable();
+	in_response = false;
+	pid_resume();
+}
+
+
+bool json_in_response(void)
+{
+	return in_response;
 }
 
 
@@ -17,12 +17,17 @@ typedef struct json_kv {
 	int value;
 } json_kv_t;
 
+/* json_start_response() writes "result", "msg" and "id"; the host matches responses
+ * by the last "id" it sees, so the json_add_*() keys must never repeat them.
+ */
 void json_start_response(bool result, const char *msg, int id);
 void json_add_int(const char *key, int val);
+void json_add_long(const char *key, long val);
 void json_add_object(const char *key, json_kv_t *kv_pairs, uint8_t len);
 void json_end_response(void);
 void json_respond_ok(const char *msg, int id);
 void json_respond_error(const char *msg, int id);
+bool json_in_response(void);
 
 
 #endif /* JSON_H_ */
@@ -18,6 +18,16 @@
  * Pin 6: Unassigned
  * Pin 7: Unassigned
  *
+ * Port B:
+ * Pin 0: Accelerometer INT1 (data ready)
+ * Pin 1: Accelerometer INT2 (events)
+ * Pin 2: Unassigned
+ * Pin 3: Unassigned
+ * Pin 4: JTAG TMS, or servo PWM 0 with SERVO_USE_PWM (JTAG disabled)
+ * Pin 5: JTAG TDI, or servo PWM 1 with SERVO_USE_PWM
+ * Pin 6: JTAG TCK, or servo PWM 2 with SERVO_USE_PWM
+ * Pin 7: JTAG TDO, or servo PWM 3 with SERVO_USE_PWM
+ *
  * Port C (Header J4):
  * Pin 0: Unassigned
  * Pin 1: Unassigned
@@ -63,6 +73,10 @@
 #include "i2c.h"
 #include "servo_parallax.h"
 #include "accelerometer.h"
+#include "compass_cal.h"
+#include "sensors.h"
+#include "heading.h"
+#include "odometry.h"
 #include "debug.h"
 
 
@@ -85,6 +99,10 @@ int main()
 	init_i2c();
 	init_compass();
 	init_accelerometer();
+	init_compass_cal();					// Load compass calibration from EEPROM
+	init_sensors();						// Start polling sensors in the background
+	init_heading();
+	init_odometry();
 	init_servo_parallax();
 	print_banner();						// Print welcome message to the serial port
 
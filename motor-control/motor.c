@@ -38,6 +38,7 @@
 #include "pid.h"
 #include "debug.h"
 #include "timer.h"
+#include "servo_parallax.h"
 
 /**
  * Structs representing the four motors
@@ -149,7 +150,9 @@ void init_motors(void)
 	/* Initialize the timers responsible for measuring the quadrature encoder period. */
 	init_enc_timer(&ENC_TIMER0, TC_EVSEL_CH0_gc);
 	init_enc_timer(&ENC_TIMER1, TC_EVSEL_CH1_gc);
-	init_enc_timer(&ENC_TIMER2, TC_EVSEL_CH2_gc);
+#ifndef SERVO_USE_PWM
+	init_enc_timer(&ENC_TIMER2, TC_EVSEL_CH2_gc);		// Otherwise TCE1 pulses the servos
+#endif
 	init_enc_timer(&ENC_TIMER3, TC_EVSEL_CH3_gc);
 
 	/* Initialize the 4 motor_t structs */
@@ -170,7 +173,7 @@ void init_motors(void)
  */
 void change_direction(motor_t *motor, direction_t dir)
 {
-	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
 		motor->response.dir = dir;
 	}
@@ -187,7 +190,7 @@ void change_direction(motor_t *motor, direction_t dir)
  */
 void change_pwm(motor_t *motor, int pwm)
 {
-	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
 		motor->response.pwm = pwm;
 	}
@@ -204,7 +207,7 @@ void change_pwm(motor_t *motor, int pwm)
  */
 void update_speed(motor_t *motor)
 {
-	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
 		switch(motor->response.dir)
 		{
@@ -225,6 +228,23 @@ void update_speed(motor_t *motor)
 }
 
 
+/**
+ * Brake every motor immediately. Doesn't stop the PID loop from driving them again;
+ * call pid_disable() first.
+ */
+void brake_motors(void)
+{
+	change_direction(&motor_a, DIR_BRAKE);
+	change_direction(&motor_b, DIR_BRAKE);
+	change_direction(&motor_c, DIR_BRAKE);
+	change_direction(&motor_d, DIR_BRAKE);
+	update_speed(&motor_a);
+	update_speed(&motor_b);
+	update_speed(&motor_c);
+	update_speed(&motor_d);
+}
+
+
 void clear_encoder_count(void)
 {
 #if NUM_MOTORS == 4
@@ -255,6 +275,35 @@ void clear_encoder_count(void)
 }
 
 
+/**
+ * Signed encoder ticks since the last call. Encoder counts only ever increase, so
+ * the sign comes from the direction the motor is being driven. A count that went
+ * backwards was cleared by clear_encoder_count() in the meantime.
+ *
+ * @param motor Motor to read
+ * @param last_count The caller's copy of the count at its previous call
+ * @return Ticks moved, negative in reverse
+ */
+int motor_encoder_delta(motor_t *motor, unsigned long int *last_count)
+{
+	unsigned long int count;
+	int delta;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		count = motor->encoder_count;
+	}
+
+	if(count < *last_count)
+		*last_count = 0;
+
+	delta = count - *last_count;
+	*last_count = count;
+
+	return (motor->response.dir == DIR_REVERSE) ? -delta : delta;
+}
+
+
 ISR(PORTD_INT0_vect)
 {
 	DEBUG_ENTER_ISR(DEBUG_ISR_ENCODER);
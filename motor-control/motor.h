@@ -107,6 +107,8 @@ void change_direction(motor_t *motor, direction_t dir);
 void change_pwm(motor_t *motor, int pwm);
 void update_speed(motor_t *motor);
 void init_motors(void);
+void brake_motors(void);
 void clear_encoder_count(void);
+int motor_encoder_delta(motor_t *motor, unsigned long int *last_count);
 
 #endif /* MOTOR_H_ */
@@ -0,0 +1,172 @@
+/*
+ * odometry.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+#include "motor.h"
+#include "fixmath.h"
+#include "heading.h"
+#include "odometry.h"
+
+#define FRAC_BITS			8					// Bearing is kept in tenths of a degree << 8
+#define FULL_TURN			(3600L << FRAC_BITS)
+#define UM_PER_TENTH_MM_Q8	80425L				// pi * 100 um << 8, per tenth of a mm of diameter
+#define TENTHS_PER_RAD_Q8	146681ULL			// 1800 / pi << 8
+
+static volatile long x_um, y_um;
+static volatile long bearing;					// Tenths of a degree << FRAC_BITS
+static long travel_scale;						// um << 8 per encoder tick
+static long turn_scale;							// Bearing units << 8 per tick of left minus right
+static unsigned int wheel_diameter = ODOMETRY_WHEEL_DIAMETER;
+static unsigned int ticks_per_rev = ODOMETRY_TICKS_PER_REV;
+static unsigned int track_width = ODOMETRY_TRACK_WIDTH;
+static unsigned long int left_count, right_count;
+static bool running = false;
+
+
+static inline long wrap(long t)
+{
+	if(t >= FULL_TURN)
+		t -= FULL_TURN;
+	else if(t < 0)
+		t += FULL_TURN;
+
+	return t;
+}
+
+
+/**
+ * Start at the origin, facing the way the heading estimator says. Call after
+ * init_heading().
+ */
+void init_odometry(void)
+{
+	odometry_set_constants(wheel_diameter, ticks_per_rev, track_width);
+	odometry_set_pose(0, 0, heading_get_estimate());
+	running = true;
+}
+
+
+/**
+ * Integrate one MS_TIMER tick of encoder travel. Called from the MS_TIMER
+ * interrupt whether or not the PID loop is running.
+ */
+void odometry_tick(void)
+{
+	int left, right;
+	long turn, travel, mid;
+	int s, c;
+
+	if(! running)
+		return;
+
+#if NUM_MOTORS == 2
+	left = motor_encoder_delta(&MOTOR_LEFT, &left_count);
+	right = motor_encoder_delta(&MOTOR_RIGHT, &right_count);
+#elif NUM_MOTORS == 4
+	left = motor_encoder_delta(&MOTOR_LEFT_FRONT, &left_count);
+	right = motor_encoder_delta(&MOTOR_RIGHT_FRONT, &right_count);
+#endif
+
+	if(left == 0 && right == 0)
+		return;
+
+	/* Left wheel ahead of the right one turns clockwise, as in heading_tick() */
+	turn = ((long)(left - right) * turn_scale) >> 8;
+	travel = ((long)(left + right) * travel_scale) >> 9;
+
+	/* Move along the bearing halfway through the turn, which is exact for an arc */
+	mid = wrap(bearing + turn / 2) >> FRAC_BITS;
+	s = fixmath_sin(mid);
+	c = fixmath_cos(mid);
+
+	x_um += (travel * s + FIXMATH_ONE / 2) >> 14;
+	y_um += (travel * c + FIXMATH_ONE / 2) >> 14;
+	bearing = wrap(bearing + turn);
+}
+
+
+/**
+ * Get the current pose
+ */
+void odometry_get_pose(pose_t *p)
+{
+	long x, y, t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		x = x_um;
+		y = y_um;
+		t = bearing;
+	}
+
+	p->x = x / 1000;
+	p->y = y / 1000;
+	p->theta = t >> FRAC_BITS;
+}
+
+
+/**
+ * Move the pose, e.g. to zero it at a known starting point
+ *
+ * @param x mm east
+ * @param y mm north
+ * @param theta Tenths of a degree clockwise from north, any value
+ */
+void odometry_set_pose(int x, int y, int theta)
+{
+	theta %= 3600;
+	if(theta < 0)
+		theta += 3600;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		x_um = x * 1000L;
+		y_um = y * 1000L;
+		bearing = (long)theta << FRAC_BITS;
+	}
+}
+
+
+/**
+ * Change the calibration. Ignored if any of them is 0.
+ *
+ * @param new_wheel_diameter Tenths of a mm
+ * @param new_ticks_per_rev Encoder ticks per wheel revolution
+ * @param new_track_width mm between the wheel contact points
+ */
+void odometry_set_constants(unsigned int new_wheel_diameter, unsigned int new_ticks_per_rev,
+							unsigned int new_track_width)
+{
+	long travel;
+	long turn;
+
+	if(new_wheel_diameter == 0 || new_ticks_per_rev == 0 || new_track_width == 0)
+		return;
+
+	/* Worked out once here so that odometry_tick() only multiplies and shifts */
+	travel = (new_wheel_diameter * UM_PER_TENTH_MM_Q8) / new_ticks_per_rev;
+	turn = (travel * TENTHS_PER_RAD_Q8) / (new_track_width * 1000UL);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		wheel_diameter = new_wheel_diameter;
+		ticks_per_rev = new_ticks_per_rev;
+		track_width = new_track_width;
+		travel_scale = travel;
+		turn_scale = turn;
+	}
+}
+
+
+void odometry_get_constants(unsigned int *wheel_diameter_out, unsigned int *ticks_per_rev_out,
+							unsigned int *track_width_out)
+{
+	*wheel_diameter_out = wheel_diameter;
+	*ticks_per_rev_out = ticks_per_rev;
+	*track_width_out = track_width;
+}
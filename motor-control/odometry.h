@@ -0,0 +1,41 @@
+/*
+ * odometry.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Dead reckoning from the drive encoders. Every MS_TIMER tick the pose is moved
+ * along the average of the left and right wheel travel, and turned by their
+ * difference, so it only drifts by as much as the wheels slip.
+ *
+ * x is east and y is north, in mm; theta is a bearing like the compass heading,
+ * in tenths of a degree clockwise from north.
+ */
+
+#ifndef ODOMETRY_H_
+#define ODOMETRY_H_
+
+#include <stdint.h>
+
+#define ODOMETRY_WHEEL_DIAMETER		650		// Tenths of a mm
+#define ODOMETRY_TICKS_PER_REV		464		// Encoder ticks per wheel revolution
+#define ODOMETRY_TRACK_WIDTH		126		// mm between the wheel contact points, matches HEADING_TICKS_PER_TURN
+
+/**
+ * Robot position and bearing. See odometry.h for the axes.
+ */
+typedef struct pose {
+	int x;					// mm east of where odometry_set_pose() put it
+	int y;					// mm north
+	int theta;				// Tenths of a degree, 0-3599
+} pose_t;
+
+void init_odometry(void);
+void odometry_tick(void);
+void odometry_get_pose(pose_t *p);
+void odometry_set_pose(int x, int y, int theta);
+void odometry_set_constants(unsigned int wheel_diameter, unsigned int ticks_per_rev,
+							unsigned int track_width);
+void odometry_get_constants(unsigned int *wheel_diameter, unsigned int *ticks_per_rev,
+							unsigned int *track_width);
+
+#endif /* ODOMETRY_H_ */
@@ -14,8 +14,10 @@
 #include <util/atomic.h>
 #include "debug.h"
 #include "motor.h"
-#include "compass.h"
+#include "heading.h"
 #include "timer.h"
+#include "buffer.h"
+#include "uart.h"
 #include "json.h"
 #include "pid.h"
 
@@ -25,9 +27,12 @@ static int heading_setpoint;
 static int motor_setpoint;		// either speed or distance, depending on PID_CONTROL_SPEED
 controller_t heading_pid;
 static bool pid_enabled = false;
+static volatile uint8_t pid_paused = 0;		// Nesting count of pid_pause()
 static unsigned long int time = 0;
 static unsigned long distance = 0;
-static bool json_response_sent = false;
+static volatile bool json_response_sent = false;
+static const char * volatile abort_msg = NULL;	// Error to answer the long command with
+static volatile int abort_id;					// Its id, in case another has started since
 static int heading_deadband = PID_HEADING_TOLERANCE;
 static int delta_speed = 10;
 static int current_ramp_speed = 0;
@@ -254,7 +259,7 @@ void compute_next_pid_iteration(void)
 	right_setpoint = get_motor_setpoint(&MOTOR_RIGHT);
 
 #ifndef PID_IGNORE_HEADING
-	current_heading = compass_get_bearing();
+	current_heading = heading_get_estimate();
 	heading_error = normalize_heading(heading_setpoint - current_heading);
 
 	if(abs(heading_error) > heading_deadband)
@@ -359,7 +364,7 @@ void change_setpoint(int heading_sp,
 	/* Calculate absolute heading, add or subtract 360 degrees if necessary */
 	if(heading_is_relative)
 	{
-		current_heading = compass_get_bearing();
+		current_heading = heading_get_estimate();
 		new_heading_setpoint = normalize_heading(heading_sp + current_heading);
 	}
 	else
@@ -396,7 +401,7 @@ void change_heading(int heading_sp, bool is_relative)
 
 	if(is_relative)
 	{
-		current_heading = compass_get_bearing();
+		current_heading = heading_get_estimate();
 		new_heading_setpoint = normalize_heading(heading_sp + current_heading);
 	}
 	else
@@ -499,21 +504,87 @@ bool pid_is_enabled(void)
 }
 
 
-void set_heading_deadband(int new_deadband)
+/**
+ * Hold off PID iterations without disabling the loop, e.g. while printing. Unlike
+ * pid_disable() followed by pid_enable(), this can't undo a pid_disable() made by an
+ * interrupt in the meantime. Calls nest, and each must be matched by pid_resume().
+ */
+void pid_pause(void)
+{
+	pid_paused++;
+}
+
+
+void pid_resume(void)
+{
+	pid_paused--;
+}
+
+
+bool pid_is_paused(void)
+{
+	return pid_paused != 0;
+}
+
+
+/**
+ * Stop the PID loop from an interrupt, e.g. for an obstacle. If a long command
+ * (move, set, turn) was still running, pid_abort_tick() answers it with msg as the
+ * error, so the host isn't left waiting for a response that would never come.
+ *
+ * @param msg Error message, must be a constant string
+ */
+void pid_abort(const char *msg)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(pid_enabled && ! json_response_sent)
+		{
+			json_response_sent = true;
+			abort_msg = msg;
+			abort_id = id_long;
+		}
+		pid_enabled = false;
+	}
+}
+
+
+/**
+ * Answer a long command stopped by pid_abort(). Called every MS_TIMER tick; like
+ * event_tick(), it waits for a tick when no other response is being printed and
+ * the TX buffer can take the whole line.
+ */
+void pid_abort_tick(void)
 {
-	bool enabled = pid_enabled;
+	if(abort_msg == NULL || json_in_response()
+	   || buffer_free(&debug_uart.write_buffer) < PID_ABORT_LINE_MAX)
+		return;
+
+	json_respond_error(abort_msg, abort_id);
+	abort_msg = NULL;
+}
+
 
-	if(enabled) pid_enabled = false;
+/**
+ * Motor speed setpoint before heading correction; negative when reversing
+ */
+int pid_get_motor_setpoint(void)
+{
+	return motor_setpoint;
+}
+
+
+void set_heading_deadband(int new_deadband)
+{
+	pid_pause();
 	heading_deadband = new_deadband;
-	if(enabled) pid_enabled = true;
+	pid_resume();
 }
 
 
 void set_ramp(int new_ramp)
 {
-	bool enabled = pid_enabled;
-
-	if(enabled) pid_enabled = false;
+	pid_pause();
 	delta_speed = new_ramp;
-	if(enabled) pid_enabled = true;
+	pid_resume();
 }
@@ -31,6 +31,7 @@
 #define PID_HEADING_ISUM_MAX	10000000
 #define PID_HEADING_TOLERANCE	50
 #define PID_NUM_SAMPLES 		128		// Number of samples to save in memory after changing the setpoint
+#define PID_ABORT_LINE_MAX		48		// Longest error response from pid_abort_tick()
 
 
 typedef struct sample {
@@ -76,6 +77,12 @@ void change_motor_constants(int p, int i, int d);
 void pid_enable(void);
 void pid_disable(void);
 bool pid_is_enabled(void);
+void pid_pause(void);
+void pid_resume(void);
+bool pid_is_paused(void);
+void pid_abort(const char *msg);
+void pid_abort_tick(void);
+int pid_get_motor_setpoint(void);
 void change_heading(int heading_sp, bool is_relative);
 void change_speed(int new_speed);
 void change_distance(int new_distance);
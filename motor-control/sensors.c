@@ -0,0 +1,580 @@
+/*
+ * sensors.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "i2c.h"
+#include "compass.h"
+#include "compass_cal.h"
+#include "accelerometer.h"
+#include "ultrasonic.h"
+#include "timer.h"
+#include "sensors.h"
+
+/**
+ * One periodically polled I2C sensor
+ */
+typedef struct sensor_poll {
+	i2c_transaction_t transaction;
+	uint8_t tx_data[1];
+	uint8_t rx_data[6];
+	uint8_t period;					// In MS_TIMER ticks
+	uint8_t countdown;
+	uint8_t skip;					// Number of due polls to let pass without reading
+} sensor_poll_t;
+
+/**
+ * Output mode tracking for one compass. With a calibration stored (or one being
+ * collected) the compass is switched between RAWX and RAWY and the heading is
+ * computed here; otherwise its own heading output is read as before.
+ */
+typedef struct compass_state {
+	compass_t compass;
+	sensor_poll_t *poll;
+	i2c_transaction_t mode_write;
+	uint8_t mode_tx[3];
+	uint8_t outmode;				// Output mode the compass is in
+	uint8_t prev_outmode;			// Restored if a mode write fails
+	int16_t raw_x;
+} compass_state_t;
+
+static sensor_poll_t polls[SENSOR_NUM_SOURCES];
+static compass_state_t compasses[COMPASS_CAL_NUM_COMPASSES];
+static volatile sensor_snapshot_t snapshot;
+static bool sensors_running = false;
+static volatile fusion_mode_t fusion_mode = FUSION_AUTO;
+static volatile bool flat_seen = false;			// The compass has answered at least once
+static volatile bool ramp_seen = false;
+
+
+/**
+ * Normalize a bearing difference to -1800..1800
+ */
+static inline int bearing_difference(int a, int b)
+{
+	int diff = a - b;
+
+	if(diff > 1800)
+		diff -= 3600;
+	else if(diff < -1800)
+		diff += 3600;
+
+	return diff;
+}
+
+
+/**
+ * Weight of the ramp compass from the accelerometer's tilt. Works with tan^2 so
+ * that no square root or trig is needed.
+ */
+static inline int tilt_weight(accelerometer_data_t *a)
+{
+	const long lo = (long)FUSION_FLAT_MAX_TAN * FUSION_FLAT_MAX_TAN / 16;
+	const long hi = (long)FUSION_RAMP_MIN_TAN * FUSION_RAMP_MIN_TAN / 16;
+	long x = a->x >> 2, y = a->y >> 2, z = a->z >> 2;	// Keep the squares well inside 32 bits
+	long h2 = x*x + y*y;
+	long z2 = z*z;
+	long tan2;											// tan^2(tilt) * 4096
+
+	if(h2 >= z2)										// 45 degrees or more
+		return FUSION_WEIGHT_ONE;
+
+	tan2 = (h2 << 12) / z2;
+
+	if(tan2 <= lo)
+		return 0;
+	if(tan2 >= hi)
+		return FUSION_WEIGHT_ONE;
+
+	return (tan2 - lo) * FUSION_WEIGHT_ONE / (hi - lo);
+}
+
+
+/**
+ * Recompute the fused heading from the latest compass and accelerometer values.
+ * Called from the TWI interrupt with the snapshot locked.
+ */
+static void fuse_heading(void)
+{
+	unsigned long int now = tick_count;
+	bool flat_ok = flat_seen && now - snapshot.heading_flat_time < SENSORS_STALE_MS / MS_TIMER_PER;
+	bool ramp_ok = ramp_seen && now - snapshot.heading_ramp_time < SENSORS_STALE_MS / MS_TIMER_PER;
+	int weight;
+	int heading;
+
+	switch(fusion_mode)
+	{
+	case FUSION_FLAT:
+	case FUSION_TILT:
+		weight = 0;
+		break;
+	case FUSION_RAMP:
+		weight = FUSION_WEIGHT_ONE;
+		break;
+	default:
+		weight = tilt_weight((accelerometer_data_t *)&snapshot.accel);
+
+		/* Fall back to whichever compass is still answering */
+		if(! ramp_ok && flat_ok)
+			weight = 0;
+		else if(! flat_ok && ramp_ok)
+			weight = FUSION_WEIGHT_ONE;
+		break;
+	}
+
+	/* Blend along the shorter arc so the result stays continuous across north */
+	heading = snapshot.heading_flat
+			+ (long)bearing_difference(snapshot.heading_ramp, snapshot.heading_flat) * weight
+			  / FUSION_WEIGHT_ONE;
+
+	if(heading < 0)
+		heading += 3600;
+	else if(heading >= 3600)
+		heading -= 3600;
+
+	snapshot.heading = heading;
+	snapshot.heading_time = now;
+	snapshot.ramp_weight = weight;
+}
+
+
+/**
+ * Store a new heading from one compass and update the fused heading
+ *
+ * @param c Compass it came from
+ * @param abs_heading Heading in the compass' own frame, tenths of a degree
+ */
+static void publish_heading(compass_state_t *c, uint16_t abs_heading)
+{
+	int bearing = compass_raw_to_bearing(abs_heading);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(c->compass == COMPASS_RAMP)
+		{
+			bearing -= COMPASS_RAMP_OFFSET;
+			if(bearing < 0)
+				bearing += 3600;
+			snapshot.heading_ramp = bearing;
+			snapshot.heading_ramp_time = tick_count;
+			ramp_seen = true;
+		}
+		else
+		{
+			snapshot.heading_flat = bearing;
+			snapshot.heading_flat_time = tick_count;
+			flat_seen = true;
+		}
+
+		fuse_heading();
+	}
+}
+
+
+/**
+ * Completion callback for an output mode write. If it failed the compass is still
+ * in its old mode.
+ */
+static void compass_mode_done(i2c_transaction_t *t)
+{
+	compass_state_t *c = t->context;
+
+	if(t->status != I2C_STATUS_OK)
+		c->outmode = c->prev_outmode;
+}
+
+
+/**
+ * Switch a compass' output mode. The compass only applies it from its next
+ * measurement, so the following poll is skipped; in raw mode a heading therefore
+ * takes four poll periods (200 ms at the default rate).
+ */
+static void compass_set_outmode(compass_state_t *c, uint8_t mode)
+{
+	c->prev_outmode = c->outmode;
+	c->outmode = mode;
+	c->mode_tx[0] = COMPASS_WRITE_RAM;
+	c->mode_tx[1] = COMPASS_RAM_OUTMODE;
+	c->mode_tx[2] = mode;
+
+	if(i2c_submit(&c->mode_write))
+		c->poll->skip = 1;
+	else
+		c->outmode = c->prev_outmode;
+}
+
+
+/**
+ * Completion callback for the compass polls, called from the TWI interrupt
+ */
+static void compass_done(i2c_transaction_t *t)
+{
+	compass_state_t *c = t->context;
+	uint16_t data = t->rx_data[1] | (t->rx_data[0] << 8);
+	bool raw = compass_cal_raw_wanted(c->compass);
+	accelerometer_data_t a;
+
+	if(t->status != I2C_STATUS_OK || i2c_in_progress(&c->mode_write))
+		return;
+
+	switch(c->outmode)
+	{
+	case COMPASS_OUTMODE_HEADING:
+		if(raw)
+			compass_set_outmode(c, COMPASS_OUTMODE_RAWX);
+		else
+			publish_heading(c, data);
+		break;
+	case COMPASS_OUTMODE_RAWX:
+		c->raw_x = (int16_t)data;
+		compass_set_outmode(c, raw ? COMPASS_OUTMODE_RAWY : COMPASS_OUTMODE_HEADING);
+		break;
+	case COMPASS_OUTMODE_RAWY:
+		compass_cal_sample(c->compass, c->raw_x, (int16_t)data);
+		if(fusion_mode == FUSION_TILT && c->compass == COMPASS_FLAT)
+		{
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				a = snapshot.accel;
+			}
+			publish_heading(c, compass_cal_tilt_heading(c->compass, c->raw_x, (int16_t)data, &a));
+		}
+		else
+		{
+			publish_heading(c, compass_cal_heading(c->compass, c->raw_x, (int16_t)data));
+		}
+		compass_set_outmode(c, raw ? COMPASS_OUTMODE_RAWX : COMPASS_OUTMODE_HEADING);
+		break;
+	default:
+		compass_set_outmode(c, COMPASS_OUTMODE_HEADING);
+		break;
+	}
+}
+
+
+/**
+ * Completion callback for the accelerometer poll, called from the TWI interrupt
+ */
+static void accel_done(i2c_transaction_t *t)
+{
+	accelerometer_data_t a;
+
+	if(t->status != I2C_STATUS_OK)
+		return;
+
+	accelerometer_decode(t->rx_data, &a);
+	sensors_update_accel(&a);
+}
+
+
+static inline void init_poll(sensor_poll_t *p,
+							 uint8_t address,
+							 uint8_t tx_bytes,
+							 uint8_t rx_bytes,
+							 i2c_callback_t callback,
+							 unsigned int period_ms)
+{
+	p->transaction.address = address;
+	p->transaction.tx_bytes = tx_bytes;
+	p->transaction.rx_bytes = rx_bytes;
+	p->transaction.tx_data = p->tx_data;
+	p->transaction.rx_data = p->rx_data;
+	p->transaction.callback = callback;
+	p->transaction.context = NULL;
+	p->transaction.status = I2C_STATUS_IDLE;
+	p->period = period_ms / MS_TIMER_PER;
+	p->countdown = p->period;
+	p->skip = 0;
+}
+
+
+static inline void init_compass_state(compass_state_t *c,
+									  compass_t compass,
+									  sensor_poll_t *p)
+{
+	c->compass = compass;
+	c->poll = p;
+	c->outmode = COMPASS_OUTMODE_HEADING;
+	c->prev_outmode = COMPASS_OUTMODE_HEADING;
+
+	c->mode_write.address = p->transaction.address;
+	c->mode_write.tx_bytes = sizeof(c->mode_tx);
+	c->mode_write.rx_bytes = 0;
+	c->mode_write.tx_data = c->mode_tx;
+	c->mode_write.rx_data = NULL;
+	c->mode_write.callback = compass_mode_done;
+	c->mode_write.context = c;
+	c->mode_write.status = I2C_STATUS_IDLE;
+
+	p->transaction.context = c;
+}
+
+
+/**
+ * Start periodic acquisition. Call after the I2C bus and the sensors themselves
+ * have been initialized. The snapshot is seeded with one blocking read of each
+ * sensor. A sensor that doesn't answer keeps a time of 0, and the fused heading
+ * isn't published until a compass has answered.
+ */
+void init_sensors(void)
+{
+	accelerometer_data_t a;
+	int bearing;
+	uint8_t i;
+
+	init_poll(&polls[SENSOR_SOURCE_COMPASS_FLAT],
+			  COMPASS_FLAT_TWI_ADDRESS,
+			  0,
+			  2,
+			  compass_done,
+			  SENSORS_COMPASS_PERIOD_MS);
+	init_compass_state(&compasses[COMPASS_FLAT], COMPASS_FLAT, &polls[SENSOR_SOURCE_COMPASS_FLAT]);
+
+	init_poll(&polls[SENSOR_SOURCE_COMPASS_RAMP],
+			  COMPASS_RAMP_TWI_ADDRESS,
+			  0,
+			  2,
+			  compass_done,
+			  SENSORS_COMPASS_PERIOD_MS);
+	init_compass_state(&compasses[COMPASS_RAMP], COMPASS_RAMP, &polls[SENSOR_SOURCE_COMPASS_RAMP]);
+
+	polls[SENSOR_SOURCE_ACCEL].tx_data[0] = ACCEL_OUT_X_MSB;
+	init_poll(&polls[SENSOR_SOURCE_ACCEL],
+			  ACCEL_TWI_ADDRESS,
+			  1,
+			  6,
+			  accel_done,
+			  SENSORS_ACCEL_PERIOD_MS);
+
+	for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+	{
+		snapshot.ultrasonic[i] = -1;
+		snapshot.ultrasonic_filtered[i].mm = -1;
+		snapshot.ultrasonic_filtered[i].valid = false;
+	}
+
+	if(I2C_RETRY(accelerometer_get_data(&a)))
+	{
+		snapshot.accel = a;
+		snapshot.accel_time = get_tick_count();
+	}
+
+	/* The output mode survives a reset of this board, so put it back to heading */
+	compass_set(COMPASS_RAMP);
+	I2C_RETRY(compass_write_ram(COMPASS_RAM_OUTMODE, COMPASS_OUTMODE_HEADING));
+	if(compass_try_bearing(&bearing))
+	{
+		bearing -= COMPASS_RAMP_OFFSET;
+		if(bearing < 0)
+			bearing += 3600;
+		snapshot.heading_ramp = bearing;
+		snapshot.heading_ramp_time = get_tick_count();
+		ramp_seen = true;
+	}
+
+	compass_set(COMPASS_FLAT);
+	I2C_RETRY(compass_write_ram(COMPASS_RAM_OUTMODE, COMPASS_OUTMODE_HEADING));
+	if(compass_try_bearing(&bearing))
+	{
+		snapshot.heading_flat = bearing;
+		snapshot.heading_flat_time = get_tick_count();
+		flat_seen = true;
+	}
+
+	if(flat_seen || ramp_seen)
+	{
+		ATOMIC_BLOCK(ATOMIC_FORCEON)
+		{
+			fuse_heading();
+		}
+	}
+
+	sensors_running = true;
+}
+
+
+/**
+ * Queue any sensor reads that are due. Called from the MS_TIMER interrupt.
+ *
+ * A poll whose previous transaction is still queued or on the bus is skipped
+ * rather than queued twice, so a slow or missing sensor can't fill the I2C queue.
+ */
+void sensors_tick(void)
+{
+	sensor_poll_t *p;
+
+	if(! sensors_running)
+		return;
+
+	accelerometer_tick();
+
+	for(p = polls; p < polls + SENSOR_NUM_SOURCES; p++)
+	{
+		if(p->period == 0 || --p->countdown != 0)
+			continue;
+
+		p->countdown = p->period;
+
+		if(p->skip)
+		{
+			p->skip--;
+			continue;
+		}
+
+		if(i2c_in_progress(&p->transaction))
+			continue;
+
+		i2c_submit(&p->transaction);
+	}
+}
+
+
+/**
+ * Copy the latest sensor values
+ *
+ * @param s Pointer to a sensor_snapshot_t struct to fill in
+ */
+void sensors_get_snapshot(sensor_snapshot_t *s)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*s = *(sensor_snapshot_t *)&snapshot;
+	}
+}
+
+
+/**
+ * Returns the latest fused compass bearing, in tenths of a degree
+ */
+int sensors_get_heading(void)
+{
+	int heading;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		heading = snapshot.heading;
+	}
+
+	return heading;
+}
+
+
+/**
+ * Returns the latest fused compass bearing along with the tick_count at which it
+ * was computed, so callers can tell whether it has changed. The time is 0 until a
+ * compass has answered.
+ */
+int sensors_get_heading_sample(unsigned long int *time)
+{
+	int heading;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		heading = snapshot.heading;
+		*time = snapshot.heading_time;
+	}
+
+	return heading;
+}
+
+
+/**
+ * Publish an accelerometer sample. Called from the TWI interrupt.
+ */
+void sensors_update_accel(accelerometer_data_t *a)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		snapshot.accel = *a;
+		snapshot.accel_time = tick_count;
+	}
+}
+
+
+/**
+ * Publish an ultrasonic measurement. Called from the ultrasonic timer interrupt.
+ *
+ * @param id Sensor the measurement came from
+ * @param distance Measured distance, or -1 if there was no echo
+ * @param r Filtered reading including this measurement
+ */
+void sensors_update_ultrasonic(ultrasonic_id_t id, int distance, const ultrasonic_reading_t *r)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		snapshot.ultrasonic[id] = distance;
+		snapshot.ultrasonic_time[id] = tick_count;
+		snapshot.ultrasonic_filtered[id] = *r;
+	}
+}
+
+
+/**
+ * Change how often a sensor is polled
+ *
+ * @param source Sensor to change
+ * @param period_ms New period, rounded down to a multiple of MS_TIMER_PER, or 0 to
+ * 		  stop polling
+ * @return True if the period is in range, otherwise false
+ */
+bool sensors_set_period(sensor_source_t source, unsigned int period_ms)
+{
+	uint8_t period = period_ms / MS_TIMER_PER;
+
+	if(source >= SENSOR_NUM_SOURCES || period_ms > SENSORS_MAX_PERIOD_MS
+			|| (period_ms != 0 && period == 0))
+		return false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		polls[source].period = period;
+		polls[source].countdown = period;
+	}
+
+	return true;
+}
+
+
+/**
+ * Returns the poll period of a sensor in milliseconds, or 0 if it is not polled
+ */
+unsigned int sensors_get_period(sensor_source_t source)
+{
+	return (unsigned int)polls[source].period * MS_TIMER_PER;
+}
+
+
+/**
+ * Returns how many milliseconds ago a snapshot timestamp was taken, saturating
+ * at 32767 so it still prints as a positive int.
+ */
+unsigned int sensors_age_ms(unsigned long int time)
+{
+	unsigned long int age = get_tick_count() - time;
+
+	if(age > 0x7fffu / MS_TIMER_PER)
+		return 0x7fff;
+
+	return age * MS_TIMER_PER;
+}
+
+
+/**
+ * Choose how the two compasses are combined. FUSION_FLAT and FUSION_RAMP replace
+ * the old practice of switching compasses with compass_set() from the host.
+ */
+void sensors_set_fusion_mode(fusion_mode_t mode)
+{
+	fusion_mode = mode;
+}
+
+
+fusion_mode_t sensors_get_fusion_mode(void)
+{
+	return fusion_mode;
+}
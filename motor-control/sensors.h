@@ -0,0 +1,84 @@
+/*
+ * sensors.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Periodic sensor acquisition. The compass and accelerometer are polled from the
+ * MS_TIMER interrupt with queued I2C transactions, and the ultrasonic sensors
+ * publish each measurement as it completes. Everything lands in one snapshot, so
+ * readers get a consistent copy without touching the bus.
+ */
+
+#ifndef SENSORS_H_
+#define SENSORS_H_
+
+#include <avr/io.h>
+#include <stdbool.h>
+#include "timer.h"
+#include "accelerometer.h"
+#include "ultrasonic.h"
+
+#define SENSORS_COMPASS_PERIOD_MS	50		// Compass updates internally at 20 Hz
+#ifdef ACCEL_USE_DRDY
+#define SENSORS_ACCEL_PERIOD_MS		0		// Samples arrive on the data-ready interrupt
+#else
+#define SENSORS_ACCEL_PERIOD_MS		20
+#endif
+#define SENSORS_MAX_PERIOD_MS		(255*MS_TIMER_PER)
+#define SENSORS_STALE_MS			250		// Ignore a compass that hasn't answered for this long
+
+/* Tilt thresholds for compass fusion, as tan(tilt) * 256. Below FLAT_MAX only the flat
+ * compass is used, above RAMP_MIN only the ramp compass, and in between the two are
+ * blended linearly in tan^2.
+ */
+#define FUSION_FLAT_MAX_TAN			26		// ~6 degrees
+#define FUSION_RAMP_MIN_TAN			70		// ~15 degrees
+#define FUSION_WEIGHT_ONE			256		// Weight of the ramp compass when on the ramp
+
+typedef enum sensor_source {
+	SENSOR_SOURCE_COMPASS_FLAT,
+	SENSOR_SOURCE_COMPASS_RAMP,
+	SENSOR_SOURCE_ACCEL,
+	SENSOR_NUM_SOURCES
+} sensor_source_t;
+
+typedef enum fusion_mode {
+	FUSION_AUTO,			// Weight the compasses by tilt
+	FUSION_FLAT,			// Flat compass only
+	FUSION_RAMP,			// Ramp compass only
+	FUSION_TILT				// Flat compass only, tilt compensated (needs a calibration)
+} fusion_mode_t;
+
+/**
+ * Latest value of every sensor. Each *_time field is the tick_count at which the
+ * value arrived, or 0 if it has never been read.
+ */
+typedef struct sensor_snapshot {
+	int heading;										// Fused bearing, tenths of a degree
+	unsigned long int heading_time;
+	int heading_flat;									// Flat compass bearing
+	unsigned long int heading_flat_time;
+	int heading_ramp;									// Ramp compass bearing, offset applied
+	unsigned long int heading_ramp_time;
+	int ramp_weight;									// 0 to FUSION_WEIGHT_ONE
+	accelerometer_data_t accel;
+	unsigned long int accel_time;
+	int ultrasonic[ULTRASONIC_NUM_SENSORS];				// Same units as get_ultrasonic_distance()
+	unsigned long int ultrasonic_time[ULTRASONIC_NUM_SENSORS];
+	ultrasonic_reading_t ultrasonic_filtered[ULTRASONIC_NUM_SENSORS];
+} sensor_snapshot_t;
+
+void init_sensors(void);
+void sensors_tick(void);
+void sensors_get_snapshot(sensor_snapshot_t *s);
+int sensors_get_heading(void);
+int sensors_get_heading_sample(unsigned long int *time);
+void sensors_update_ultrasonic(ultrasonic_id_t id, int distance, const ultrasonic_reading_t *r);
+void sensors_update_accel(accelerometer_data_t *a);
+bool sensors_set_period(sensor_source_t source, unsigned int period_ms);
+unsigned int sensors_get_period(sensor_source_t source);
+unsigned int sensors_age_ms(unsigned long int time);
+void sensors_set_fusion_mode(fusion_mode_t mode);
+fusion_mode_t sensors_get_fusion_mode(void);
+
+#endif /* SENSORS_H_ */
@@ -10,14 +10,25 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
+#include "clock.h"
 #include "motor.h"
 #include "servo_parallax.h"
+#include "servo_sequence.h"
+#include "SerialCommands.h"
 #include "ultrasonic.h"
 #include "compass.h"
 #include "timer.h"
 #include "accelerometer.h"
 #include "pid.h"
 #include "uart.h"
+#include "i2c.h"
+#include "compass_cal.h"
+#include "sensors.h"
+#include "heading.h"
+#include "odometry.h"
+#include "fixmath.h"
+#include "event.h"
 #include "json.h"
 #include "serial_interactive.h"
 
@@ -41,8 +52,18 @@ const char *delimiters = " \r\n";
  * keep this up to date as more tokens are added.
  */
 const char *tokens[] = { "a",
+					   	 "accel_cal",
+					   	 "accel_cal_clear",
+					   	 "accel_event",
+					   	 "accel_mode",
+					   	 "accel_stats",
 					   	 "b",
 					   	 "c",
+					   	 "compass_auto",
+					   	 "compass_cal_clear",
+					   	 "compass_cal_start",
+					   	 "compass_cal_status",
+					   	 "compass_cal_stop",
 					   	 "compass_calibrate",
 					   	 "compass_dump_eeprom",
 					   	 "compass_flat",
@@ -52,13 +73,16 @@ const char *tokens[] = { "a",
 					   	 "compass_reset",
 					   	 "compass_start_calibration",
 					   	 "compass_stop_calibration",
+					   	 "compass_tilt",
 					   	 "compass_write_eeprom",
 					   	 "compass_write_ram",
 					   	 "d",
 					   	 "heading",
 					   	 "heading_accuracy",
+					   	 "heading_est",
 					   	 "heading_pid",
 					   	 "help",
+					   	 "i2c_stats",
 					   	 "interactive",
 					   	 "left_close",
 					   	 "left_down",
@@ -66,9 +90,12 @@ const char *tokens[] = { "a",
 					   	 "left_grab",
 					   	 "left_open",
 					   	 "left_up",
+					   	 "math_bench",
 					   	 "motor_pid",
 					   	 "motor_step_response",
 					   	 "move",
+					   	 "odometry",
+					   	 "pose",
 					   	 "pwm",
 					   	 "pwm_drive",
 					   	 "ramp",
@@ -82,37 +109,75 @@ const char *tokens[] = { "a",
 					   	 "right_up",
 					   	 "s",
 					   	 "sensor",
+					   	 "sensor_rate",
 					   	 "sensors",
 					   	 "sensors_continuous",
 					   	 "servo",
+					   	 "servo_baud",
+					   	 "servo_pos",
+					   	 "servo_stats",
 					   	 "set",
 					   	 "sizeofs",
 					   	 "status",
 					   	 "stop",
 					   	 "straight",
+					   	 "tilt_bench",
 					   	 "turn_abs",
 					   	 "turn_in_place",
-					   	 "turn_rel"
+					   	 "turn_rel",
+					   	 "ultrasonic_range",
+					   	 "us_drop",
+					   	 "us_rates",
+					   	 "us_stop",
+					   	 "us_weights"
 };
 
 const char *prompt = "> ";
 const char *banner = "\x1b[2J\x1b[HNCSU IEEE 2012 Hardware Team Motor Controller\r\n"
 					 "Type \"help\" for a list of available commands.\r\n";
-const char *help = "heading\r\n"
+const char *help = "accel_cal [samples]\r\n"
+				   "accel_cal_clear\r\n"
+				   "accel_event [motion|freefall|transient|pulse] [threshold] [count]\r\n"
+				   "accel_mode [normal|fast|fifo] [Hz]\r\n"
+				   "accel_stats\r\n"
+				   "compass_auto\r\n"
+				   "compass_cal_start\r\n"
+				   "compass_cal_status\r\n"
+				   "compass_cal_stop\r\n"
+				   "compass_cal_clear\r\n"
+				   "compass_flat\r\n"
+				   "compass_ramp\r\n"
+				   "compass_tilt\r\n"
+				   "heading\r\n"
+				   "heading_est [ticks/turn] [gain]\r\n"
 				   "heading_pid [Kp] [Ki] [Kd]\r\n"
 				   "help\r\n"
+				   "i2c_stats\r\n"
+				   "math_bench\r\n"
 				   "motor_pid [Kp] [Ki] [Kd]\r\n"
+				   "odometry [wheel diameter 0.1mm] [ticks/rev] [track mm]\r\n"
+				   "pose [x mm] [y mm] [theta]\r\n"
 				   "pwm [a|b|c|d] [0-10000]\r\n"
 				   "pwm_drive [left] [right]\r\n"
 				   "reset\r\n"
+				   "sensor_rate [compass|accel] [ms]\r\n"
 				   "sensors\r\n"
 				   "servo [channel] [ramp] [angle]\r\n"
+				   "servo_baud [2400|38400]\r\n"
+				   "servo_pos\r\n"
+				   "servo_stats\r\n"
 				   "set [heading] [speed] [distance]\r\n"
 				   "sizeofs\r\n"
 				   "status\r\n"
 				   "stop\r\n"
 				   "straight [pwm]\r\n"
-				   "turn_in_place [pwm]\r\n";
+				   "tilt_bench\r\n"
+				   "turn_in_place [pwm]\r\n"
+				   "ultrasonic_range [left|front|bottom|right|back] [mm]\r\n"
+				   "us_drop [mm]\r\n"
+				   "us_rates\r\n"
+				   "us_stop [base mm] [mm added at full speed]\r\n"
+				   "us_weights [stopped|forward|reverse|turning] [0-9 per sensor]\r\n";
 //const char *error = "ERROR\r\n";
 //const char *ok = "OK\r\n";
 //const char *bad_motor = "Bad motor.\r\n";
@@ -120,6 +185,8 @@ const char *help = "heading\r\n"
 const char *lf = "\n";
 const char *crlf = "\r\n";
 const char *argument_error = "too few arguments";
+const char *i2c_error = "i2c error";
+const char *servo_busy = "servo busy";
 const char *empty_string = "";
 
 bool interactive_mode = false;
@@ -204,22 +271,223 @@ static inline motor_t *get_motor(token_t token)
 }
 
 
+/* Stand the robot still and level first */
+static inline void exec_accel_cal(void)
+{
+	char *samples_str = NEXT_STRING();
+	unsigned int samples = ACCEL_CAL_SAMPLES;
+	accel_cal_t cal;
+	json_kv_t kv[3];
+
+	if(samples_str != NULL)
+		samples = atoi(samples_str);
+
+	if(samples == 0 || samples > 1024)
+	{
+		json_respond_error("samples out of range", id_short);
+		return;
+	}
+
+	if(! accelerometer_calibrate(samples))
+	{
+		json_respond_error("no samples", id_short);
+		return;
+	}
+
+	accelerometer_get_calibration(&cal);
+	kv[0].key = "x";
+	kv[0].value = cal.offset[0] * 2;
+	kv[1].key = "y";
+	kv[1].value = cal.offset[1] * 2;
+	kv[2].key = "z";
+	kv[2].value = cal.offset[2] * 2;
+
+	json_start_response(true, empty_string, id_short);
+	json_add_object("offset_mg", kv, sizeof(kv)/sizeof(json_kv_t));
+	json_end_response();
+}
+
+
+static inline void exec_accel_cal_clear(void)
+{
+	if(accelerometer_clear_calibration())
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("accelerometer not responding", id_short);
+}
+
+
+static inline void exec_accel_event(void)
+{
+	const char *event_names[] = {"motion", "freefall", "transient", "pulse"};
+	char *event_str = NEXT_STRING();
+	char *threshold_str = NEXT_STRING();
+	char *count_str = NEXT_STRING();
+	accel_event_t event;
+	uint8_t threshold, count;
+	json_kv_t kv[2];
+
+	if(event_str == NULL)
+	{
+		json_start_response(true, empty_string, id_short);
+		for(event = ACCEL_EVENT_MOTION; event < ACCEL_NUM_EVENTS; event++)
+		{
+			accelerometer_get_event(event, &threshold, &count);
+			kv[0].key = "threshold";
+			kv[0].value = threshold;
+			kv[1].key = "count";
+			kv[1].value = count;
+			json_add_object(event_names[event], kv, sizeof(kv)/sizeof(json_kv_t));
+		}
+		json_add_int("dropped", event_get_dropped());
+		json_end_response();
+		return;
+	}
+
+	for(event = ACCEL_EVENT_MOTION; event < ACCEL_NUM_EVENTS; event++)
+	{
+		if(strcmp(event_str, event_names[event]) == 0)
+			break;
+	}
+
+	if(event >= ACCEL_NUM_EVENTS)
+		json_respond_error("unrecognized event", id_short);
+	else if(threshold_str == NULL)
+		json_respond_error(argument_error, id_short);
+	else if(atoi(threshold_str) < 0 || atoi(threshold_str) > 127
+			|| (count_str != NULL && (atoi(count_str) < 0 || atoi(count_str) > 255)))
+		json_respond_error("out of range", id_short);
+	else if(accelerometer_set_event(event,
+									atoi(threshold_str),
+									(count_str != NULL) ? atoi(count_str) : 0))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("accelerometer not responding", id_short);
+}
+
+
+static inline void exec_accel_mode(void)
+{
+	const char *mode_names[] = {"normal", "fast", "fifo"};
+	char *mode_str = NEXT_STRING();
+	char *rate_str = NEXT_STRING();
+	accel_mode_t mode;
+
+	if(mode_str == NULL)
+	{
+		json_start_response(true, mode_names[accelerometer_get_mode()], id_short);
+		json_add_int("rate", accelerometer_get_rate());
+		json_add_int("whoami", accelerometer_get_id());
+		json_end_response();
+		return;
+	}
+
+	for(mode = ACCEL_MODE_NORMAL; mode <= ACCEL_MODE_FIFO; mode++)
+	{
+		if(strcmp(mode_str, mode_names[mode]) == 0)
+			break;
+	}
+
+	if(mode > ACCEL_MODE_FIFO)
+		json_respond_error("unrecognized mode", id_short);
+	else if(accelerometer_set_mode(mode, (rate_str != NULL) ? atoi(rate_str) : 0))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("mode not supported", id_short);
+}
+
+
+static inline void exec_accel_stats(void)
+{
+	accel_stats_t stats;
+
+	accelerometer_get_stats(&stats);
+
+	json_start_response(true, empty_string, id_short);
+	json_add_int("samples", stats.samples);
+	json_add_int("dropped", stats.dropped);
+	json_add_int("rearms", stats.rearms);
+	json_add_int("bursts", stats.bursts);
+	json_add_int("queued", accelerometer_sample_count());
+	json_add_int("period", sensors_get_period(SENSOR_SOURCE_ACCEL));
+	json_end_response();
+}
+
+
+/* Kept for old hosts; starts the same non-blocking calibration as compass_cal_start */
 static inline void exec_compass_calibrate(void)
 {
-	bool enabled = pid_is_enabled();
+	compass_cal_start();
+	json_respond_ok("spin the robot, then compass_cal_stop", id_short);
+}
 
-	if(enabled) pid_disable();
 
-//	while(! compass_write_ram(COMPASS_RAM_OPMODE, COMPASS_OPMODE_STANDBY));
-	while(! compass_enter_calibration_mode());
+static inline void exec_compass_cal_clear(void)
+{
+	compass_cal_clear();
+	json_respond_ok(empty_string, id_short);
+}
 
-	for(ms_timer = 0; ms_timer < (20000/MS_TIMER_PER););	// Delay 20 s
 
-	while(! compass_exit_calibration_mode());
-	while(! compass_save_opmode());
-	init_compass();
+static inline void exec_compass_cal_start(void)
+{
+	compass_cal_start();
+	json_respond_ok(empty_string, id_short);
+}
+
+
+static inline void add_compass_cal_object(const char *key, compass_t compass)
+{
+	compass_cal_t cal;
+	compass_cal_progress_t progress;
+	json_kv_t kv[7];
+
+	compass_cal_get(compass, &cal, &progress);
+
+	kv[0].key = "valid";
+	kv[0].value = cal.magic == COMPASS_CAL_MAGIC;
+	kv[1].key = "offsetX";
+	kv[1].value = cal.offset_x;
+	kv[2].key = "offsetY";
+	kv[2].value = cal.offset_y;
+	kv[3].key = "scaleY";
+	kv[3].value = cal.scale_y;
+	kv[4].key = "samples";
+	kv[4].value = progress.samples;
+	kv[5].key = "spanX";
+	kv[5].value = progress.samples ? progress.max_x - progress.min_x : 0;
+	kv[6].key = "spanY";
+	kv[6].value = progress.samples ? progress.max_y - progress.min_y : 0;
+
+	json_add_object(key, kv, sizeof(kv)/sizeof(json_kv_t));
+}
+
+
+static inline void exec_compass_cal_status(void)
+{
+	json_start_response(true, empty_string, id_short);
+	json_add_int("collecting", compass_cal_is_collecting());
+	add_compass_cal_object("flat", COMPASS_FLAT);
+	add_compass_cal_object("ramp", COMPASS_RAMP);
+	json_end_response();
+}
+
+
+static inline void exec_compass_cal_stop(void)
+{
+	uint8_t fitted = compass_cal_stop();
 
-	if(enabled) pid_enable();
+	if(fitted)
+	{
+		json_start_response(true, empty_string, id_short);
+		json_add_int("flat", (fitted & (1 << COMPASS_FLAT)) != 0);
+		json_add_int("ramp", (fitted & (1 << COMPASS_RAMP)) != 0);
+		json_end_response();
+	}
+	else
+	{
+		json_respond_error("not enough rotation", id_short);
+	}
 }
 
 
@@ -232,11 +500,19 @@ static inline void exec_compass_dump_eeprom(void)
 
 	for(i=0; i<9; i++)
 	{
-		while(! compass_read_eeprom(i, &eeprom[i]));
+		if(! I2C_RETRY(compass_read_eeprom(i, &eeprom[i])))
+		{
+			json_respond_error(i2c_error, id_short);
+			return;
+		}
 	}
 
-	compass_read_ram(COMPASS_RAM_OPMODE, &opmode);
-	compass_read_ram(COMPASS_RAM_OUTMODE, &outmode);
+	if(! I2C_RETRY(compass_read_ram(COMPASS_RAM_OPMODE, &opmode))
+			|| ! I2C_RETRY(compass_read_ram(COMPASS_RAM_OUTMODE, &outmode)))
+	{
+		json_respond_error(i2c_error, id_short);
+		return;
+	}
 
 	json_start_response(true, empty_string, id_short);
 	json_add_int("COMPASS_EEPROM_I2C_ADDRESS", eeprom[COMPASS_EEPROM_I2C_ADDRESS]);
@@ -254,9 +530,34 @@ static inline void exec_compass_dump_eeprom(void)
 }
 
 
+static inline void exec_compass_auto(void)
+{
+	sensors_set_fusion_mode(FUSION_AUTO);
+	json_respond_ok(empty_string, id_short);
+}
+
+
+static inline void exec_compass_tilt(void)
+{
+	if(compass_cal_is_valid(COMPASS_FLAT))
+	{
+		sensors_set_fusion_mode(FUSION_TILT);
+		json_respond_ok(empty_string, id_short);
+	}
+	else
+	{
+		json_respond_error("flat compass not calibrated", id_short);
+	}
+}
+
+
+/* compass_flat and compass_ramp pin the fused heading to one compass, and select it
+ * for the compass_read/write commands.
+ */
 static inline void exec_compass_flat(void)
 {
 	compass_set(COMPASS_FLAT);
+	sensors_set_fusion_mode(FUSION_FLAT);
 	json_respond_ok(empty_string, id_short);
 }
 
@@ -264,6 +565,7 @@ static inline void exec_compass_flat(void)
 static inline void exec_compass_ramp(void)
 {
 	compass_set(COMPASS_RAMP);
+	sensors_set_fusion_mode(FUSION_RAMP);
 	json_respond_ok(empty_string, id_short);
 }
 
@@ -277,7 +579,11 @@ static inline void exec_compass_read_eeprom(void)
 	if(address_str != NULL)
 	{
 		address = atoi(address_str);
-		while(! compass_read_eeprom(address, &data));
+		if(! I2C_RETRY(compass_read_eeprom(address, &data)))
+		{
+			json_respond_error(i2c_error, id_short);
+			return;
+		}
 		json_start_response(true, empty_string, id_short);
 		json_add_int("address", address);
 		json_add_int("data", data);
@@ -299,7 +605,11 @@ static inline void exec_compass_read_ram(void)
 	if(address_str != NULL)
 	{
 		address = atoi(address_str);
-		while(! compass_read_ram(address, &data));
+		if(! I2C_RETRY(compass_read_ram(address, &data)))
+		{
+			json_respond_error(i2c_error, id_short);
+			return;
+		}
 		json_start_response(true, empty_string, id_short);
 		json_add_int("address", address);
 		json_add_int("data", data);
@@ -314,22 +624,28 @@ static inline void exec_compass_read_ram(void)
 
 static inline void exec_compass_reset(void)
 {
-	init_compass();
-	json_respond_ok(empty_string, id_short);
+	if(init_compass())
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error(i2c_error, id_short);
 }
 
 
 static inline void exec_compass_start_calibration(void)
 {
-	while(! compass_enter_calibration_mode());
-	json_respond_ok(empty_string, id_short);
+	if(I2C_RETRY(compass_enter_calibration_mode()))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error(i2c_error, id_short);
 }
 
 
 static inline void exec_compass_stop_calibration(void)
 {
-	while(! compass_exit_calibration_mode());
-	json_respond_ok(empty_string, id_short);
+	if(I2C_RETRY(compass_exit_calibration_mode()))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error(i2c_error, id_short);
 }
 
 
@@ -344,7 +660,11 @@ static inline void exec_compass_write_eeprom(void)
 	{
 		address = atoi(address_str);
 		data = atoi(data_str);
-		while(! compass_write_eeprom(address, data));
+		if(! I2C_RETRY(compass_write_eeprom(address, data)))
+		{
+			json_respond_error(i2c_error, id_short);
+			return;
+		}
 		json_start_response(true, empty_string, id_short);
 		json_add_int("address", address);
 		json_add_int("data", data);
@@ -368,7 +688,11 @@ static inline void exec_compass_write_ram(void)
 	{
 		address = atoi(address_str);
 		data = atoi(data_str);
-		while(! compass_write_ram(address, data));
+		if(! I2C_RETRY(compass_write_ram(address, data)))
+		{
+			json_respond_error(i2c_error, id_short);
+			return;
+		}
 		json_start_response(true, empty_string, id_short);
 		json_add_int("address", address);
 		json_add_int("data", data);
@@ -383,7 +707,7 @@ static inline void exec_compass_write_ram(void)
 
 static inline void exec_heading(void)
 {
-	uint16_t heading = compass_get_bearing();
+	uint16_t heading = sensors_get_heading();
 
 	json_start_response(true, "deprecated, use 'sensors' instead", id_short);
 	json_add_int("data", heading);
@@ -391,6 +715,31 @@ static inline void exec_heading(void)
 }
 
 
+static inline void exec_heading_est(void)
+{
+	char *ticks_str = NEXT_STRING();
+	char *gain_str = NEXT_STRING();
+
+	if(ticks_str != NULL)
+	{
+		if(gain_str == NULL)
+		{
+			json_respond_error(argument_error, id_short);
+			return;
+		}
+
+		heading_set_constants(atoi(ticks_str), atoi(gain_str));
+	}
+
+	json_start_response(true, empty_string, id_short);
+	json_add_int("estimate", heading_get_estimate());
+	json_add_int("compass", sensors_get_heading());
+	json_add_int("ticksPerTurn", heading_get_ticks_per_turn());
+	json_add_int("gain", heading_get_gain());
+	json_end_response();
+}
+
+
 static inline void exec_heading_accuracy(void)
 {
 	char *deadband = NEXT_STRING();
@@ -431,6 +780,37 @@ static inline void exec_help(void)
 }
 
 
+static inline void exec_i2c_stats(void)
+{
+	uint8_t i;
+	char key[4];
+	json_kv_t kv[4];
+
+	json_start_response(true, empty_string, id_short);
+	json_add_int("recoveries", i2c_bus_recoveries);
+
+	for(i=0; i<I2C_MAX_DEVICES; i++)
+	{
+		if(i2c_stats[i].transactions == 0)
+			continue;
+
+		kv[0].key = "total";
+		kv[0].value = i2c_stats[i].transactions;
+		kv[1].key = "nack";
+		kv[1].value = i2c_stats[i].nacks;
+		kv[2].key = "buserr";
+		kv[2].value = i2c_stats[i].bus_errors;
+		kv[3].key = "timeout";
+		kv[3].value = i2c_stats[i].timeouts;
+
+		sprintf(key, "%d", i2c_stats[i].address);
+		json_add_object(key, kv, sizeof(kv)/sizeof(json_kv_t));
+	}
+
+	json_end_response();
+}
+
+
 static inline void exec_left_close(void)
 {
 	parallax_set_angle(SERVO_LEFT_GRIP_CHANNEL, SERVO_LEFT_GRIP_CLOSE, SERVO_GRIP_RAMP);
@@ -445,20 +825,18 @@ static inline void exec_left_down(void)
 }
 
 
+/* The servo sequences answer with id_short when they finish */
 static inline void exec_left_drop(void)
 {
-	parallax_set_angle(SERVO_LEFT_ARM_CHANNEL, SERVO_LEFT_ARM_DOWN, SERVO_ARM_RAMP);
-	parallax_set_angle(SERVO_LEFT_GRIP_CHANNEL, SERVO_LEFT_GRIP_OPEN, SERVO_GRIP_RAMP);
-	json_respond_ok(empty_string, id_short);
+	if(! servo_sequence_start(&servo_left_drop, id_short))
+		json_respond_error(servo_busy, id_short);
 }
 
 
 static inline void exec_left_grab(void)
 {
-	parallax_set_angle(SERVO_LEFT_GRIP_CHANNEL, SERVO_LEFT_GRIP_CLOSE, SERVO_GRIP_RAMP);
-	for(ms_timer=0; ms_timer<SERVO_CLOSE_TIME;);	// wait for arm to close
-	parallax_set_angle(SERVO_LEFT_ARM_CHANNEL, SERVO_LEFT_ARM_UP, SERVO_ARM_RAMP);
-	json_respond_ok(empty_string, id_short);
+	if(! servo_sequence_start(&servo_left_grab, id_short))
+		json_respond_error(servo_busy, id_short);
 }
 
 
@@ -565,6 +943,63 @@ static inline void exec_move(void)
 }
 
 
+static inline void exec_odometry(void)
+{
+	char *diameter_str = NEXT_STRING();
+	char *ticks_str = NEXT_STRING();
+	char *track_str = NEXT_STRING();
+	unsigned int diameter, ticks, track;
+
+	if(diameter_str != NULL)
+	{
+		if(ticks_str == NULL || track_str == NULL
+		   || atoi(diameter_str) <= 0 || atoi(ticks_str) <= 0 || atoi(track_str) <= 0)
+		{
+			json_respond_error(argument_error, id_short);
+			return;
+		}
+
+		odometry_set_constants(atoi(diameter_str), atoi(ticks_str), atoi(track_str));
+	}
+
+	odometry_get_constants(&diameter, &ticks, &track);
+
+	json_start_response(true, empty_string, id_short);
+	json_add_int("wheelDiameter", diameter);
+	json_add_int("ticksPerRev", ticks);
+	json_add_int("trackWidth", track);
+	json_end_response();
+}
+
+
+static inline void exec_pose(void)
+{
+	char *x_str = NEXT_STRING();
+	char *y_str = NEXT_STRING();
+	char *theta_str = NEXT_STRING();
+	pose_t p;
+
+	if(x_str != NULL)
+	{
+		if(y_str == NULL || theta_str == NULL)
+		{
+			json_respond_error(argument_error, id_short);
+			return;
+		}
+
+		odometry_set_pose(atoi(x_str), atoi(y_str), atoi(theta_str));
+	}
+
+	odometry_get_pose(&p);
+
+	json_start_response(true, empty_string, id_short);
+	json_add_int("x", p.x);
+	json_add_int("y", p.y);
+	json_add_int("theta", p.theta);
+	json_end_response();
+}
+
+
 static inline void exec_pwm(void)
 {
 	motor_t *motor = get_motor(NEXT_TOKEN());
@@ -712,6 +1147,12 @@ static inline void exec_reset(void)
 
 static inline void exec_reset_servos(void)
 {
+	if(servo_sequence_busy())
+	{
+		json_respond_error(servo_busy, id_short);
+		return;
+	}
+
 	init_servo_parallax();
 	json_respond_ok(empty_string, id_short);
 }
@@ -733,18 +1174,15 @@ static inline void exec_right_down(void)
 
 static inline void exec_right_drop(void)
 {
-	parallax_set_angle(SERVO_RIGHT_ARM_CHANNEL, SERVO_RIGHT_ARM_DOWN, SERVO_ARM_RAMP);
-	parallax_set_angle(SERVO_RIGHT_GRIP_CHANNEL, SERVO_RIGHT_GRIP_OPEN, SERVO_GRIP_RAMP);
-	json_respond_ok(empty_string, id_short);
+	if(! servo_sequence_start(&servo_right_drop, id_short))
+		json_respond_error(servo_busy, id_short);
 }
 
 
 static inline void exec_right_grab(void)
 {
-	parallax_set_angle(SERVO_RIGHT_GRIP_CHANNEL, SERVO_RIGHT_GRIP_CLOSE, SERVO_GRIP_RAMP);
-	for(ms_timer=0; ms_timer<SERVO_CLOSE_TIME;);	// wait for arm to close
-	parallax_set_angle(SERVO_RIGHT_ARM_CHANNEL, SERVO_RIGHT_ARM_UP, SERVO_ARM_RAMP);
-	json_respond_ok(empty_string, id_short);
+	if(! servo_sequence_start(&servo_right_grab, id_short))
+		json_respond_error(servo_busy, id_short);
 }
 
 
@@ -766,38 +1204,37 @@ static inline void exec_sensor(void)
 {
 	char *id_str = NEXT_STRING();
 	int data;
-	accelerometer_data_t a;
+	sensor_snapshot_t s;
 
 	if(id_str != NULL)
 	{
+		sensors_get_snapshot(&s);
+
 		switch(atoi(id_str))
 		{
 		case SENSOR_COMPASS:
-			data = compass_get_bearing();
+			data = s.heading;
 			break;
 		case SENSOR_ACCEL_X:
-			accelerometer_get_data(&a);
-			data = a.x;
+			data = s.accel.x;
 			break;
 		case SENSOR_ACCEL_Y:
-			accelerometer_get_data(&a);
-			data = a.y;
+			data = s.accel.y;
 			break;
 		case SENSOR_ACCEL_Z:
-			accelerometer_get_data(&a);
-			data = a.z;
+			data = s.accel.z;
 			break;
 		case SENSOR_US_LEFT:
-			data = get_ultrasonic_distance(ULTRASONIC_LEFT);
+			data = s.ultrasonic[ULTRASONIC_LEFT];
 			break;
 		case SENSOR_US_FRONT:
-			data = get_ultrasonic_distance(ULTRASONIC_FRONT);
+			data = s.ultrasonic[ULTRASONIC_FRONT];
 			break;
 		case SENSOR_US_RIGHT:
-			data = get_ultrasonic_distance(ULTRASONIC_RIGHT);
+			data = s.ultrasonic[ULTRASONIC_RIGHT];
 			break;
 		case SENSOR_US_BACK:
-			data = get_ultrasonic_distance(ULTRASONIC_BACK);
+			data = s.ultrasonic[ULTRASONIC_BACK];
 			break;
 		default:
 			json_respond_error("unrecognized sensor id", id_short);
@@ -816,36 +1253,119 @@ static inline void exec_sensor(void)
 }
 
 
+static inline void exec_sensor_rate(void)
+{
+	char *source_str = NEXT_STRING();
+	char *period_str = NEXT_STRING();
+	sensor_source_t source;
+
+	if(source_str == NULL)
+	{
+		json_start_response(true, empty_string, id_short);
+		json_add_int("compass", sensors_get_period(SENSOR_SOURCE_COMPASS_FLAT));
+		json_add_int("accel", sensors_get_period(SENSOR_SOURCE_ACCEL));
+		json_end_response();
+		return;
+	}
+
+	if(strcmp(source_str, "compass") == 0)
+		source = SENSOR_SOURCE_COMPASS_FLAT;
+	else if(strcmp(source_str, "accel") == 0)
+		source = SENSOR_SOURCE_ACCEL;
+	else
+	{
+		json_respond_error("unrecognized sensor", id_short);
+		return;
+	}
+
+	if(period_str == NULL)
+		json_respond_error(argument_error, id_short);
+	else if(sensors_set_period(source, atoi(period_str)))
+	{
+		/* Both compasses are polled at the same rate */
+		if(source == SENSOR_SOURCE_COMPASS_FLAT)
+			sensors_set_period(SENSOR_SOURCE_COMPASS_RAMP, atoi(period_str));
+		json_respond_ok(empty_string, id_short);
+	}
+	else
+		json_respond_error("period out of range", id_short);
+}
+
+
 static inline void exec_sensors(void)
 {
-	int heading;
-	accelerometer_data_t a;
+	sensor_snapshot_t s;
 	json_kv_t us_array[4];
+	json_kv_t mm_array[4];
 	json_kv_t accel_array[3];
+	json_kv_t age_array[3];
+	json_kv_t compass_array[4];
+	json_kv_t pose_array[3];
+	pose_t p;
+
+	sensors_get_snapshot(&s);
+	odometry_get_pose(&p);
+
+	compass_array[0].key = "flat";
+	compass_array[0].value = s.heading_flat;
+	compass_array[1].key = "ramp";
+	compass_array[1].value = s.heading_ramp;
+	compass_array[2].key = "weight";
+	compass_array[2].value = s.ramp_weight;
+	compass_array[3].key = "mode";
+	compass_array[3].value = sensors_get_fusion_mode();
 
 	accel_array[0].key = "x";
-	accel_array[0].value = a.x;
+	accel_array[0].value = s.accel.x;
 	accel_array[1].key = "y";
-	accel_array[1].value = a.y;
+	accel_array[1].value = s.accel.y;
 	accel_array[2].key = "z";
-	accel_array[2].value = a.z;
+	accel_array[2].value = s.accel.z;
 
 	us_array[0].key = "left";
-	us_array[0].value = get_ultrasonic_distance(ULTRASONIC_LEFT);
+	us_array[0].value = s.ultrasonic[ULTRASONIC_LEFT];
 	us_array[1].key = "right";
-	us_array[1].value = get_ultrasonic_distance(ULTRASONIC_RIGHT);
+	us_array[1].value = s.ultrasonic[ULTRASONIC_RIGHT];
 	us_array[2].key = "front";
-	us_array[2].value = get_ultrasonic_distance(ULTRASONIC_FRONT);
+	us_array[2].value = s.ultrasonic[ULTRASONIC_FRONT];
 	us_array[3].key = "back";
-	us_array[3].value = get_ultrasonic_distance(ULTRASONIC_BACK);
-
-	heading = compass_get_bearing();
-	while(! accelerometer_get_data(&a));
+	us_array[3].value = s.ultrasonic[ULTRASONIC_BACK];
+
+	/* Filtered distances, -1 if the sensor sees nothing in range */
+	mm_array[0].key = "left";
+	mm_array[0].value = s.ultrasonic_filtered[ULTRASONIC_LEFT].mm;
+	mm_array[1].key = "right";
+	mm_array[1].value = s.ultrasonic_filtered[ULTRASONIC_RIGHT].mm;
+	mm_array[2].key = "front";
+	mm_array[2].value = s.ultrasonic_filtered[ULTRASONIC_FRONT].mm;
+	mm_array[3].key = "back";
+	mm_array[3].value = s.ultrasonic_filtered[ULTRASONIC_BACK].mm;
+
+	/* How stale the I2C sensors are, in ms. How often each ultrasonic sensor
+	 * is read depends on the scheduling weights, see us_rates.
+	 */
+	age_array[0].key = "flat";
+	age_array[0].value = sensors_age_ms(s.heading_flat_time);
+	age_array[1].key = "ramp";
+	age_array[1].value = sensors_age_ms(s.heading_ramp_time);
+	age_array[2].key = "accel";
+	age_array[2].value = sensors_age_ms(s.accel_time);
+
+	pose_array[0].key = "x";
+	pose_array[0].value = p.x;
+	pose_array[1].key = "y";
+	pose_array[1].value = p.y;
+	pose_array[2].key = "theta";
+	pose_array[2].value = p.theta;
 
 	json_start_response(true, empty_string, id_short);
-	json_add_int("heading", heading);
+	json_add_int("heading", s.heading);
 	json_add_object("accel", accel_array, sizeof(accel_array)/sizeof(json_kv_t));
 	json_add_object("ultrasonic", us_array, sizeof(us_array)/sizeof(json_kv_t));
+	json_add_object("ultrasonic_mm", mm_array, sizeof(mm_array)/sizeof(json_kv_t));
+	json_add_object("compass", compass_array, sizeof(compass_array)/sizeof(json_kv_t));
+	json_add_object("age", age_array, sizeof(age_array)/sizeof(json_kv_t));
+	json_add_object("pose", pose_array, sizeof(pose_array)/sizeof(json_kv_t));
 	json_end_response();
 }
 
@@ -881,6 +1401,82 @@ static inline void exec_servo(void)
 }
 
 
+/* Answers with the controller's version as msg, and false if it didn't answer at
+ * the requested rate
+ */
+static inline void exec_servo_baud(void)
+{
+	char *baud_str = NEXT_STRING();
+	servo_link_t link;
+	bool ok = true;
+
+	if(baud_str != NULL)
+	{
+		if(atol(baud_str) != SERVO_BAUD_SLOW && atol(baud_str) != SERVO_BAUD_FAST)
+		{
+			json_respond_error("baud must be 2400 or 38400", id_short);
+			return;
+		}
+		if(servo_sequence_busy())
+		{
+			json_respond_error(servo_busy, id_short);
+			return;
+		}
+		ok = parallax_set_baud(atol(baud_str));
+	}
+
+	parallax_get_link(&link);
+	json_start_response(ok, link.version, id_short);
+	json_add_long("baud", link.baud);
+	json_add_int("verified", link.verified);
+	json_add_long("cmd_us", link.cmd_us);
+	json_add_long("reply_us", link.reply_us);
+	json_end_response();
+}
+
+
+/* Positions of the first SERVO_NUM channels as read back from the controller, and
+ * which channels haven't got where they were sent yet
+ */
+static inline void exec_servo_pos(void)
+{
+	static const char *channel_names[SERVO_NUM] = {"0", "1", "2", "3", "4"};
+	int positions[SERVO_NUM];
+	json_kv_t kv[SERVO_NUM];
+	uint8_t i;
+
+	parallax_get_positions(positions, SERVO_NUM);
+	for(i = 0; i < SERVO_NUM; i++)
+	{
+		kv[i].key = channel_names[i];
+		kv[i].value = positions[i];
+	}
+
+	json_start_response(true, empty_string, id_short);
+	json_add_object("pos", kv, sizeof(kv)/sizeof(json_kv_t));
+	json_add_long("moving", parallax_get_moving());
+	json_add_int("misses", parallax_get_read_misses());
+	json_end_response();
+}
+
+
+static inline void exec_servo_stats(void)
+{
+	servo_stats_t st;
+
+	parallax_get_stats(&st);
+
+	json_start_response(true, empty_string, id_short);
+	json_add_long("requested", st.requested);
+	json_add_long("sent", st.sent);
+	json_add_long("merged", st.merged);
+	json_add_long("suppressed", st.suppressed);
+	json_add_long("bursts", st.bursts);
+	json_add_long("bytes_saved", ((long)st.merged + st.suppressed) * SERVO_FRAME_SIZE);
+	json_end_response();
+}
+
+
 static inline void exec_set(void)
 {
 	char *heading_str = NEXT_STRING();
@@ -947,15 +1543,7 @@ static inline void exec_status(void)
 static inline void exec_stop(void)
 {
 	pid_disable();
-
-	change_direction(&motor_a, DIR_BRAKE);
-	change_direction(&motor_b, DIR_BRAKE);
-	change_direction(&motor_c, DIR_BRAKE);
-	change_direction(&motor_d, DIR_BRAKE);
-	update_speed(&motor_a);
-	update_speed(&motor_b);
-	update_speed(&motor_c);
-	update_speed(&motor_d);
+	brake_motors();
 
 	json_respond_ok(empty_string, id_short);
 }
@@ -1012,6 +1600,114 @@ static inline void exec_straight(void)
 }
 
 
+static accelerometer_data_t bench_accel;
+static volatile int bench_result;
+
+static void bench_tilt_heading(void)
+{
+	bench_result = compass_cal_tilt_heading(COMPASS_FLAT, 300, -200, &bench_accel);
+}
+
+
+static void bench_atan2(void)
+{
+	bench_result = fixmath_atan2(-200, 300);
+}
+
+
+/* Time one tilt-compensated heading update on the latest accelerometer sample */
+static inline void exec_tilt_bench(void)
+{
+	sensor_snapshot_t s;
+	unsigned int tilt_cycles, atan2_cycles;
+
+	sensors_get_snapshot(&s);
+	bench_accel = s.accel;
+
+	tilt_cycles = timer_measure_cycles(bench_tilt_heading, 16);
+	atan2_cycles = timer_measure_cycles(bench_atan2, 16);
+
+	json_start_response(true, empty_string, id_short);
+	json_add_int("calibrated", compass_cal_is_valid(COMPASS_FLAT));
+	json_add_int("cycles", tilt_cycles);
+	json_add_int("us", tilt_cycles / (CPU_SPEED_HZ / 1000000));
+	json_add_int("atan2Cycles", atan2_cycles);
+	json_end_response();
+}
+
+
+/* Inputs are volatile so the compiler can't work the results out in advance */
+static volatile int bench_angle = 1234;
+static volatile unsigned long bench_square = 123456789UL;
+static volatile float bench_float;
+
+static void bench_sin(void)
+{
+	bench_result = fixmath_sin(bench_angle);
+}
+
+
+static void bench_cos(void)
+{
+	bench_result = fixmath_cos(bench_angle);
+}
+
+
+static void bench_isqrt(void)
+{
+	bench_result = fixmath_isqrt(bench_square);
+}
+
+
+static void bench_sinf(void)
+{
+	bench_float = sin(bench_angle * (M_PI / 1800));
+}
+
+
+static void bench_atan2f(void)
+{
+	bench_float = atan2(-200.0, (float)bench_angle);
+}
+
+
+static void bench_sqrtf(void)
+{
+	bench_float = sqrt((float)bench_square);
+}
+
+
+/* Cycles per call of each fixmath function, and of the avr-libc float version
+ * it replaces
+ */
+static inline void exec_math_bench(void)
+{
+	json_kv_t fixed[4];
+	json_kv_t floating[3];
+
+	fixed[0].key = "sin";
+	fixed[0].value = timer_measure_cycles(bench_sin, 16);
+	fixed[1].key = "cos";
+	fixed[1].value = timer_measure_cycles(bench_cos, 16);
+	fixed[2].key = "atan2";
+	fixed[2].value = timer_measure_cycles(bench_atan2, 16);
+	fixed[3].key = "isqrt";
+	fixed[3].value = timer_measure_cycles(bench_isqrt, 16);
+
+	floating[0].key = "sin";
+	floating[0].value = timer_measure_cycles(bench_sinf, 16);
+	floating[1].key = "atan2";
+	floating[1].value = timer_measure_cycles(bench_atan2f, 16);
+	floating[2].key = "sqrt";
+	floating[2].value = timer_measure_cycles(bench_sqrtf, 16);
+
+	json_start_response(true, empty_string, id_short);
+	json_add_object("fixmath", fixed, sizeof(fixed)/sizeof(json_kv_t));
+	json_add_object("float", floating, sizeof(floating)/sizeof(json_kv_t));
+	json_end_response();
+}
+
+
 static inline void exec_turn_abs(void)
 {
 	char *heading_str = NEXT_STRING();
@@ -1097,6 +1793,204 @@ static inline void exec_turn_rel(void)
 }
 
 
+/**
+ * Names of the ultrasonic sensors, indexed by ultrasonic_id_t
+ */
+static const char *ultrasonic_names[ULTRASONIC_NUM_SENSORS] = {
+	"left", "front", "bottom", "right", "back"
+};
+
+
+/**
+ * @return The sensor with the given name, or ULTRASONIC_NUM_SENSORS if there is none
+ */
+static ultrasonic_id_t find_ultrasonic(const char *name)
+{
+	ultrasonic_id_t id;
+
+	for(id = 0; id < ULTRASONIC_NUM_SENSORS; id++)
+	{
+		if(name != NULL && strcmp(name, ultrasonic_names[id]) == 0)
+			break;
+	}
+
+	return id;
+}
+
+
+static inline void exec_ultrasonic_range(void)
+{
+	char *sensor_str = NEXT_STRING();
+	char *range_str = NEXT_STRING();
+	ultrasonic_id_t id;
+	json_kv_t kv[ULTRASONIC_NUM_SENSORS];
+
+	if(sensor_str == NULL)
+	{
+		for(id = 0; id < ULTRASONIC_NUM_SENSORS; id++)
+		{
+			kv[id].key = ultrasonic_names[id];
+			kv[id].value = ultrasonic_get_range(id);
+		}
+		json_start_response(true, empty_string, id_short);
+		json_add_object("range_mm", kv, sizeof(kv)/sizeof(json_kv_t));
+		json_end_response();
+		return;
+	}
+
+	id = find_ultrasonic(sensor_str);
+	if(id >= ULTRASONIC_NUM_SENSORS)
+		json_respond_error("unrecognized sensor", id_short);
+	else if(range_str == NULL)
+		json_respond_error(argument_error, id_short);
+	else if(ultrasonic_set_range(id, atoi(range_str)))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("range must be 100-6500 mm", id_short);
+}
+
+
+/**
+ * Names of the scheduler's motions, indexed by ultrasonic_motion_t
+ */
+static const char *motion_names[ULTRASONIC_NUM_MOTIONS] = {
+	"stopped", "forward", "reverse", "turning"
+};
+
+
+/* "us_drop 0" turns drop detection off */
+static inline void exec_us_drop(void)
+{
+	char *rise_str = NEXT_STRING();
+	ultrasonic_reading_t bottom;
+
+	if(rise_str == NULL)
+	{
+		ultrasonic_get_reading(ULTRASONIC_BOTTOM, &bottom);
+		json_start_response(true, empty_string, id_short);
+		json_add_int("rise", ultrasonic_get_drop());
+		json_add_int("floor", bottom.mm);
+		json_end_response();
+	}
+	else if(atoi(rise_str) >= 0 && ultrasonic_set_drop(atoi(rise_str)))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("rise must be 20-1000 mm", id_short);
+}
+
+
+static inline void exec_us_rates(void)
+{
+	unsigned int pings[ULTRASONIC_NUM_SENSORS];
+	unsigned int ms;
+	ultrasonic_id_t id;
+	json_kv_t kv[ULTRASONIC_NUM_SENSORS];
+
+	ms = ultrasonic_get_rates(pings);
+	for(id = 0; id < ULTRASONIC_NUM_SENSORS; id++)
+	{
+		kv[id].key = ultrasonic_names[id];
+		kv[id].value = pings[id];
+	}
+
+	json_start_response(true, motion_names[ultrasonic_get_motion()], id_short);
+	json_add_int("ms", ms);
+	json_add_object("pings", kv, sizeof(kv)/sizeof(json_kv_t));
+	json_end_response();
+}
+
+
+/* "us_stop 0" turns the obstacle stop off */
+static inline void exec_us_stop(void)
+{
+	char *base_str = NEXT_STRING();
+	char *full_str = NEXT_STRING();
+	unsigned int base, full;
+
+	if(base_str == NULL)
+	{
+		ultrasonic_get_stop(&base, &full);
+		json_start_response(true, empty_string, id_short);
+		json_add_int("base", base);
+		json_add_int("full", full);
+		json_add_int("stops", ultrasonic_get_stops());
+		json_add_int("worst_us", ultrasonic_get_stop_worst_us());
+		json_end_response();
+		return;
+	}
+
+	if(atoi(base_str) >= 0 && (full_str == NULL || atoi(full_str) >= 0)
+			&& ultrasonic_set_stop(atoi(base_str), (full_str == NULL) ? 0 : atoi(full_str)))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("distances must be 100-6500 mm", id_short);
+}
+
+
+/* Weights are given as one digit per sensor in ultrasonic_id_t order, e.g.
+ * "us_weights forward 14210", to fit the input line
+ */
+static inline void exec_us_weights(void)
+{
+	char *motion_str = NEXT_STRING();
+	char *weights_str = NEXT_STRING();
+	uint8_t w[ULTRASONIC_NUM_SENSORS];
+	ultrasonic_motion_t m;
+	ultrasonic_id_t id;
+	json_kv_t kv[ULTRASONIC_NUM_SENSORS];
+
+	if(motion_str == NULL)
+	{
+		json_start_response(true, empty_string, id_short);
+		for(m = 0; m < ULTRASONIC_NUM_MOTIONS; m++)
+		{
+			ultrasonic_get_weights(m, w);
+			for(id = 0; id < ULTRASONIC_NUM_SENSORS; id++)
+			{
+				kv[id].key = ultrasonic_names[id];
+				kv[id].value = w[id];
+			}
+			json_add_object(motion_names[m], kv, sizeof(kv)/sizeof(json_kv_t));
+		}
+		json_end_response();
+		return;
+	}
+
+	for(m = 0; m < ULTRASONIC_NUM_MOTIONS; m++)
+	{
+		if(strcmp(motion_str, motion_names[m]) == 0)
+			break;
+	}
+
+	if(m >= ULTRASONIC_NUM_MOTIONS)
+	{
+		json_respond_error("unrecognized motion", id_short);
+		return;
+	}
+
+	if(weights_str == NULL || strlen(weights_str) != ULTRASONIC_NUM_SENSORS)
+	{
+		json_respond_error("need one digit per sensor", id_short);
+		return;
+	}
+
+	for(id = 0; id < ULTRASONIC_NUM_SENSORS; id++)
+	{
+		if(! isdigit((unsigned char)weights_str[id]))
+		{
+			json_respond_error("need one digit per sensor", id_short);
+			return;
+		}
+		w[id] = weights_str[id] - '0';
+	}
+
+	if(ultrasonic_set_weights(m, w))
+		json_respond_ok(empty_string, id_short);
+	else
+		json_respond_error("weight out of range", id_short);
+}
+
+
 static inline bool is_long_command(token_t cmd)
 {
 	switch(cmd)
@@ -1166,12 +2060,42 @@ static inline void parse_command(void)
 
 	switch(command)
 	{
+	case TOKEN_ACCEL_CAL:
+		exec_accel_cal();
+		break;
+	case TOKEN_ACCEL_CAL_CLEAR:
+		exec_accel_cal_clear();
+		break;
+	case TOKEN_ACCEL_EVENT:
+		exec_accel_event();
+		break;
+	case TOKEN_ACCEL_MODE:
+		exec_accel_mode();
+		break;
+	case TOKEN_ACCEL_STATS:
+		exec_accel_stats();
+		break;
 	case TOKEN_COMPASS_CALIBRATE:
 		exec_compass_calibrate();
 		break;
 	case TOKEN_COMPASS_DUMP_EEPROM:
 		exec_compass_dump_eeprom();
 		break;
+	case TOKEN_COMPASS_AUTO:
+		exec_compass_auto();
+		break;
+	case TOKEN_COMPASS_CAL_CLEAR:
+		exec_compass_cal_clear();
+		break;
+	case TOKEN_COMPASS_CAL_START:
+		exec_compass_cal_start();
+		break;
+	case TOKEN_COMPASS_CAL_STATUS:
+		exec_compass_cal_status();
+		break;
+	case TOKEN_COMPASS_CAL_STOP:
+		exec_compass_cal_stop();
+		break;
 	case TOKEN_COMPASS_FLAT:
 		exec_compass_flat();
 		break;
@@ -1193,6 +2117,9 @@ static inline void parse_command(void)
 	case TOKEN_COMPASS_STOP_CALIBRATION:
 		exec_compass_stop_calibration();
 		break;
+	case TOKEN_COMPASS_TILT:
+		exec_compass_tilt();
+		break;
 	case TOKEN_COMPASS_WRITE_EEPROM:
 		exec_compass_write_eeprom();
 		break;
@@ -1205,12 +2132,18 @@ static inline void parse_command(void)
 	case TOKEN_HEADING_ACCURACY:
 		exec_heading_accuracy();
 		break;
+	case TOKEN_HEADING_EST:
+		exec_heading_est();
+		break;
 	case TOKEN_HEADING_PID:
 		exec_heading_pid();
 		break;
 	case TOKEN_HELP:
 		exec_help();
 		break;
+	case TOKEN_I2C_STATS:
+		exec_i2c_stats();
+		break;
 	case TOKEN_INTERACTIVE:
 		exec_interactive();
 		break;
@@ -1232,6 +2165,9 @@ static inline void parse_command(void)
 	case TOKEN_LEFT_UP:
 		exec_left_up();
 		break;
+	case TOKEN_MATH_BENCH:
+		exec_math_bench();
+		break;
 	case TOKEN_MOTOR_PID:
 		exec_motor_pid();
 		break;
@@ -1241,6 +2177,12 @@ static inline void parse_command(void)
 	case TOKEN_MOVE:
 		exec_move();
 		break;
+	case TOKEN_ODOMETRY:
+		exec_odometry();
+		break;
+	case TOKEN_POSE:
+		exec_pose();
+		break;
 	case TOKEN_PWM:
 		exec_pwm();
 		break;
@@ -1280,6 +2222,9 @@ static inline void parse_command(void)
 	case TOKEN_SENSOR:
 		exec_sensor();
 		break;
+	case TOKEN_SENSOR_RATE:
+		exec_sensor_rate();
+		break;
 	case TOKEN_SENSORS:
 		exec_sensors();
 		break;
@@ -1289,6 +2234,15 @@ static inline void parse_command(void)
 	case TOKEN_SERVO:
 		exec_servo();
 		break;
+	case TOKEN_SERVO_BAUD:
+		exec_servo_baud();
+		break;
+	case TOKEN_SERVO_POS:
+		exec_servo_pos();
+		break;
+	case TOKEN_SERVO_STATS:
+		exec_servo_stats();
+		break;
 	case TOKEN_SET:
 		exec_set();
 		break;
@@ -1304,6 +2258,9 @@ static inline void parse_command(void)
 	case TOKEN_STRAIGHT:
 		exec_straight();
 		break;
+	case TOKEN_TILT_BENCH:
+		exec_tilt_bench();
+		break;
 	case TOKEN_TURN_ABS:
 		exec_turn_abs();
 		break;
@@ -1313,6 +2270,21 @@ static inline void parse_command(void)
 	case TOKEN_TURN_REL:
 		exec_turn_rel();
 		break;
+	case TOKEN_ULTRASONIC_RANGE:
+		exec_ultrasonic_range();
+		break;
+	case TOKEN_US_DROP:
+		exec_us_drop();
+		break;
+	case TOKEN_US_RATES:
+		exec_us_rates();
+		break;
+	case TOKEN_US_STOP:
+		exec_us_stop();
+		break;
+	case TOKEN_US_WEIGHTS:
+		exec_us_weights();
+		break;
 	default:
 		json_respond_error("unrecognized command", id);
 		break;
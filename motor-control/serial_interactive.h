@@ -15,8 +15,18 @@
 typedef enum token {
 	TOKEN_UNDEF = -1,
 	TOKEN_A,
+	TOKEN_ACCEL_CAL,
+	TOKEN_ACCEL_CAL_CLEAR,
+	TOKEN_ACCEL_EVENT,
+	TOKEN_ACCEL_MODE,
+	TOKEN_ACCEL_STATS,
 	TOKEN_B,
 	TOKEN_C,
+	TOKEN_COMPASS_AUTO,
+	TOKEN_COMPASS_CAL_CLEAR,
+	TOKEN_COMPASS_CAL_START,
+	TOKEN_COMPASS_CAL_STATUS,
+	TOKEN_COMPASS_CAL_STOP,
 	TOKEN_COMPASS_CALIBRATE,
 	TOKEN_COMPASS_DUMP_EEPROM,
 	TOKEN_COMPASS_FLAT,
@@ -26,13 +36,16 @@ typedef enum token {
 	TOKEN_COMPASS_RESET,
 	TOKEN_COMPASS_START_CALIBRATION,
 	TOKEN_COMPASS_STOP_CALIBRATION,
+	TOKEN_COMPASS_TILT,
 	TOKEN_COMPASS_WRITE_EEPROM,
 	TOKEN_COMPASS_WRITE_RAM,
 	TOKEN_D,
 	TOKEN_HEADING,
 	TOKEN_HEADING_ACCURACY,
+	TOKEN_HEADING_EST,
 	TOKEN_HEADING_PID,
 	TOKEN_HELP,
+	TOKEN_I2C_STATS,
 	TOKEN_INTERACTIVE,
 	TOKEN_LEFT_CLOSE,
 	TOKEN_LEFT_DOWN,
@@ -40,9 +53,12 @@ typedef enum token {
 	TOKEN_LEFT_GRAB,
 	TOKEN_LEFT_OPEN,
 	TOKEN_LEFT_UP,
+	TOKEN_MATH_BENCH,
 	TOKEN_MOTOR_PID,
 	TOKEN_MOTOR_STEP_RESPONSE,
 	TOKEN_MOVE,
+	TOKEN_ODOMETRY,
+	TOKEN_POSE,
 	TOKEN_PWM,
 	TOKEN_PWM_DRIVE,
 	TOKEN_RAMP,
@@ -56,17 +72,27 @@ typedef enum token {
 	TOKEN_RIGHT_UP,
 	TOKEN_S,
 	TOKEN_SENSOR,
+	TOKEN_SENSOR_RATE,
 	TOKEN_SENSORS,
 	TOKEN_SENSORS_CONTINUOUS,
 	TOKEN_SERVO,
+	TOKEN_SERVO_BAUD,
+	TOKEN_SERVO_POS,
+	TOKEN_SERVO_STATS,
 	TOKEN_SET,
 	TOKEN_SIZEOFS,
 	TOKEN_STATUS,
 	TOKEN_STOP,
 	TOKEN_STRAIGHT,
+	TOKEN_TILT_BENCH,
 	TOKEN_TURN_ABS,
 	TOKEN_TURN_IN_PLACE,
 	TOKEN_TURN_REL,
+	TOKEN_ULTRASONIC_RANGE,
+	TOKEN_US_DROP,
+	TOKEN_US_RATES,
+	TOKEN_US_STOP,
+	TOKEN_US_WEIGHTS,
 } token_t;
 
 
@@ -10,6 +10,7 @@
 //#include <stdlib.h>
 //#include "uart.h"
 //#include "SerialCommands.h"
+//#include "servo_parallax.h"
 //#include "serial_pandaboard.h"
 //
 //#define BUFSIZE			32
@@ -77,8 +78,7 @@
 //	sv.heading = 1800;
 //	for(i=0; i<USS_NUM; i++)
 //		sv.USS_arr[i] = 10;
-//	for(i=0; i<SERVO_NUM; i++)
-//		sv.servo_arr[i] = 20;
+//	parallax_get_positions(sv.servo_arr, SERVO_NUM);
 //
 //	printf(fmt, data->num);
 //	putchar_n((uint8_t *)&sv, sizeof(sensor_values));
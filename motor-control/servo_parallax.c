@@ -8,33 +8,207 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
 #include "uart.h"
+#include "timer.h"
+#include "event.h"
 #include "servo_parallax.h"
+#include "servo_pwm.h"
 
+#define NO_QUERY		0xff
 
-static inline void servo_putchar(uint8_t c)
+/**
+ * What the firmware knows about one servo. Positions are where the controller is
+ * driving the servo, part way along its ramp, not a measurement of the arm.
+ */
+typedef struct servo_state {
+	int target;				// Last angle sent, or -1
+	int position;			// Last angle read back, or -1
+	bool moving;			// Not yet read back at the target
+	int staged;				// Angle waiting for the next burst, or -1
+	uint8_t staged_ramp;
+	int sent;				// Angle of the last command written, or -1
+	uint8_t sent_ramp;
+} servo_state_t;
+
+static servo_link_t link = {SERVO_BAUD_SLOW, false, 0, 0, ""};
+static const uint8_t version_query[] = {'!', 'S', 'C', 'V', 'E', 'R', '?', '\r'};
+
+// Nothing staged or known yet: parallax_tick() runs from init_ms_timer() on, long
+// before init_servo_parallax()
+static volatile servo_state_t servos[SERVO_NUM_CHANNELS] = {
+	[0 ... SERVO_NUM_CHANNELS - 1] = {.target = -1, .position = -1, .staged = -1, .sent = -1}
+};
+static volatile bool link_busy = false;			// parallax_set_baud() owns the link
+static uint8_t query_channel = NO_QUERY;		// Readback waiting for a reply
+static uint8_t query_age;						// MS_TIMER ticks since it was sent
+static uint8_t next_channel = 0;				// Where to start looking for the next one
+static uint8_t reply[3];						// Last three bytes received
+static volatile unsigned int read_misses = 0;
+static volatile servo_stats_t stats;
+
+
+/**
+ * Queue a whole packet at once, waiting for room. Only for the main loop; the
+ * MS_TIMER interrupt uses uart_write() and tries again next tick instead.
+ */
+static inline void servo_put_packet(const uint8_t *buffer, uint8_t num_bytes)
+{
+	while(! uart_write(&servo_uart, buffer, num_bytes));
+}
+
+
+static void wait_us(unsigned long int us)
+{
+	unsigned long int start = timer_get_us();
+
+	while(timer_get_us() - start < us);
+}
+
+
+/**
+ * Wait until everything queued for the controller has gone out, including the
+ * last byte in the shift register (10 bits).
+ */
+static void wait_sent(void)
 {
-	uart_putchar(c, &(servo_uart.f_out));
+	while(! buffer_empty(&servo_uart.write_buffer));
+	while(! (servo_uart.usart->STATUS & USART_DREIF_bm));
+	wait_us(10000000UL / link.baud);
 }
 
 
-static inline void servo_putchar_n(uint8_t *buffer, uint8_t num_bytes)
+static void set_usart_baud(long baud)
 {
-	while(num_bytes > 0)
+	if(baud == SERVO_BAUD_FAST)
+		uart_set_baud(&servo_uart, 3269, -6);		// 38400 baud at 32 MHz clock
+	else
+		uart_set_baud(&servo_uart, 3329, -2);		// 2400 baud at 32 MHz clock
+
+	link.baud = baud;
+}
+
+
+/**
+ * Ask the controller for its version, timing the command and the reply. The
+ * reply is three characters like "1.4"; anything else received, such as the echo
+ * of the query on a shared line, is skipped.
+ *
+ * @return True if the controller answered
+ */
+static bool query_version(void)
+{
+	char last[3] = {0, 0, 0};
+	unsigned long int start, elapsed;
+	uint8_t c;
+
+	while(buffer_get(&servo_uart.read_buffer, &c));		// Stale replies
+
+	start = timer_get_us();
+	servo_put_packet(version_query, sizeof(version_query));
+	wait_sent();
+	link.cmd_us = timer_get_us() - start;
+
+	do
 	{
-		servo_putchar(*buffer);
-		buffer++;
-		num_bytes--;
+		elapsed = timer_get_us() - start;
+		while(buffer_get(&servo_uart.read_buffer, &c))
+		{
+			last[0] = last[1];
+			last[1] = last[2];
+			last[2] = c;
+			if(isdigit((int)last[0]) && last[1] == '.' && isdigit((int)last[2]))
+			{
+				link.reply_us = timer_get_us() - start;
+				memcpy(link.version, last, 3);
+				link.version[3] = '\0';
+				return true;
+			}
+		}
+	} while(elapsed < SERVO_REPLY_TIMEOUT);
+
+	link.reply_us = 0;
+	link.version[0] = '\0';
+	return false;
+}
+
+
+/**
+ * Switch the controller and servo_uart to a new baud rate, and check the
+ * controller answers at it. If it doesn't, the controller is told to go back to
+ * 2400 baud, in case it switched but can't be heard, and the link stays at 2400.
+ *
+ * Nothing else may send to the controller meanwhile, see servo_sequence_busy().
+ *
+ * @param baud SERVO_BAUD_SLOW or SERVO_BAUD_FAST
+ * @return True if the controller answered at the new rate
+ */
+bool parallax_set_baud(long baud)
+{
+	uint8_t set_baud[] = {'!', 'S', 'C', 'S', 'B', 'R', 0, '\r'};
+
+	if(baud != SERVO_BAUD_SLOW && baud != SERVO_BAUD_FAST)
+		return false;
+
+#ifdef SERVO_USE_PWM
+	return false;		// No controller to talk to
+#endif
+
+	link_busy = true;
+	query_channel = NO_QUERY;		// Its reply would be lost
+
+	set_baud[6] = (baud == SERVO_BAUD_FAST) ? 1 : 0;
+	servo_put_packet(set_baud, sizeof(set_baud));
+	wait_sent();
+	set_usart_baud(baud);
+	wait_us(SERVO_SWITCH_DELAY);
+
+	link.verified = query_version();
+	if(link.verified)
+	{
+		link_busy = false;
+		return true;
 	}
+
+	if(baud != SERVO_BAUD_SLOW)
+	{
+		set_baud[6] = 0;
+		servo_put_packet(set_baud, sizeof(set_baud));
+		wait_sent();
+		set_usart_baud(SERVO_BAUD_SLOW);
+		wait_us(SERVO_SWITCH_DELAY);
+		link.verified = query_version();
+	}
+
+	link_busy = false;
+	return false;
 }
 
 
 /**
- * Initialize the Parallax servo controller.
+ * Get the state of the link to the controller
+ */
+void parallax_get_link(servo_link_t *l)
+{
+	*l = link;
+}
+
+
+/**
+ * Initialize the Parallax servo controller, at 38400 baud if it will talk at that.
  */
 void init_servo_parallax()
 {
+#ifdef SERVO_USE_PWM
+	init_servo_pwm();
+#else
+	parallax_set_baud(SERVO_BAUD_FAST);
+#endif
 	parallax_set_angle(SERVO_LEFT_ARM_CHANNEL, SERVO_LEFT_ARM_UP, SERVO_ARM_RAMP);
 	parallax_set_angle(SERVO_RIGHT_ARM_CHANNEL, SERVO_RIGHT_ARM_UP, SERVO_ARM_RAMP);
 	parallax_set_angle(SERVO_LEFT_GRIP_CHANNEL, SERVO_LEFT_GRIP_CLOSE, SERVO_GRIP_RAMP);
@@ -62,18 +236,263 @@ int parallax_set_angle(int channel, int angle, int ramp)
 	if(ramp < 0 || ramp > 63)
 		return 0;
 
-	angle += 250;
-	uint8_t data[] = {'!',
-					  'S',
-					  'C',
-					  (char) channel,
-					  (char) ramp,
-					  (char) angle & 0xff,
-					  (char) (angle >> 8) & 0xff,
-					  '\r',
-	};
+#ifdef SERVO_USE_PWM
+	if(! servo_pwm_set_angle(channel, angle, ramp))
+		return 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		servos[channel].target = angle;
+		servos[channel].moving = true;
+	}
+#else
+	volatile servo_state_t *s = &servos[channel];
+
+	// Staged rather than sent, so that every servo moved in one MS_TIMER tick goes
+	// out in a single burst from parallax_tick()
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		stats.requested++;
+		if(s->staged >= 0)
+		{
+			stats.merged++;
+			s->staged = -1;
+		}
 
-	servo_putchar_n(data, sizeof(data));
+		if(s->sent == angle && s->sent_ramp == ramp)
+			stats.suppressed++;
+		else
+		{
+			s->staged = angle;
+			s->staged_ramp = ramp;
+		}
+
+		if(s->target != angle)
+		{
+			s->target = angle;
+			s->moving = link.verified;		// Can't be read back otherwise
+		}
+	}
+#endif
 
 	return 1;
 }
+
+
+/**
+ * Record where a servo is, read back from the controller or reported by the PWM
+ * backend, and post a "servo" event if it has got where it was sent.
+ *
+ * @param channel Servo channel
+ * @param angle Same units as parallax_set_angle()
+ */
+void parallax_set_position(uint8_t channel, int angle)
+{
+	volatile servo_state_t *s = &servos[channel];
+
+	s->position = angle;
+	if(s->moving && abs(angle - s->target) <= SERVO_POSITION_TOLERANCE)
+	{
+		s->moving = false;
+		event_post_value(EVENT_SERVO, channel, angle);
+	}
+}
+
+
+/**
+ * Write every staged position command in one burst. If the TX buffer can't take
+ * it all they stay staged for the next tick, where later commands for the same
+ * channels replace them.
+ */
+static inline void flush_staged(void)
+{
+	static uint8_t burst[SERVO_NUM_CHANNELS * SERVO_FRAME_SIZE];
+	uint8_t *f = burst;
+	uint8_t c;
+	int pw;
+
+	for(c = 0; c < SERVO_NUM_CHANNELS; c++)
+	{
+		if(servos[c].staged < 0)
+			continue;
+
+		pw = servos[c].staged + 250;
+		f[0] = '!';
+		f[1] = 'S';
+		f[2] = 'C';
+		f[3] = c;
+		f[4] = servos[c].staged_ramp;
+		f[5] = pw & 0xff;
+		f[6] = (pw >> 8) & 0xff;
+		f[7] = '\r';
+		f += SERVO_FRAME_SIZE;
+	}
+
+	if(f == burst || ! uart_write(&servo_uart, burst, f - burst))
+		return;
+
+	for(c = 0; c < SERVO_NUM_CHANNELS; c++)
+	{
+		if(servos[c].staged < 0)
+			continue;
+
+		servos[c].sent = servos[c].staged;
+		servos[c].sent_ramp = servos[c].staged_ramp;
+		servos[c].staged = -1;
+		stats.sent++;
+	}
+	stats.bursts++;
+}
+
+
+/**
+ * Look for the reply to the outstanding readback: the channel, then the pulse
+ * width high byte first, 250-1250. Nothing in the echo of the query itself can
+ * look like that.
+ *
+ * @return True if the reply was found
+ */
+static inline bool read_reply(void)
+{
+	uint8_t c;
+	int pw;
+
+	while(buffer_get(&servo_uart.read_buffer, &c))
+	{
+		reply[0] = reply[1];
+		reply[1] = reply[2];
+		reply[2] = c;
+
+		pw = (reply[1] << 8) | reply[2];
+		if(reply[0] == query_channel && pw >= 250 && pw <= 1250)
+		{
+			parallax_set_position(query_channel, pw - 250);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Send the position commands staged since the last tick, then read back the
+ * positions of moving servos, one at a time. Called every MS_TIMER tick, after
+ * servo_sequence_tick(). Readback needs a controller that answered
+ * parallax_set_baud(), since otherwise nothing may be connected to receive from.
+ */
+void parallax_tick(void)
+{
+	uint8_t query[] = {'!', 'S', 'C', 'R', 'S', 'P', 0, '\r'};
+	uint8_t stale;
+	uint8_t c;
+	uint8_t i;
+
+	if(link_busy)
+		return;
+
+#ifndef SERVO_USE_PWM
+	flush_staged();
+#endif
+
+	if(! link.verified)
+		return;
+
+	if(query_channel != NO_QUERY)
+	{
+		if(read_reply())
+			query_channel = NO_QUERY;
+		else if(++query_age < SERVO_READ_TIMEOUT)
+			return;
+		else
+		{
+			read_misses++;
+			query_channel = NO_QUERY;
+		}
+	}
+
+	for(i = 0; i < SERVO_NUM_CHANNELS; i++)
+	{
+		c = (next_channel + i) % SERVO_NUM_CHANNELS;
+		if(! servos[c].moving)
+			continue;
+
+		while(buffer_get(&servo_uart.read_buffer, &stale));
+		reply[0] = reply[1] = reply[2] = NO_QUERY;
+
+		query[6] = c;
+		if(! uart_write(&servo_uart, query, sizeof(query)))
+			break;
+		query_channel = c;
+		query_age = 0;
+		next_channel = (c + 1) % SERVO_NUM_CHANNELS;
+		break;
+	}
+}
+
+
+/**
+ * Fill in the last read back position of servo channels 0 to n - 1, -1 where none
+ * has been read yet. Same units as parallax_set_angle().
+ */
+void parallax_get_positions(int *positions, uint8_t n)
+{
+	uint8_t i;
+
+	for(i = 0; i < n && i < SERVO_NUM_CHANNELS; i++)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			positions[i] = servos[i].position;
+		}
+	}
+}
+
+
+/**
+ * Bitmask of the channels that haven't been read back at their target yet
+ */
+uint16_t parallax_get_moving(void)
+{
+	uint16_t moving = 0;
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < SERVO_NUM_CHANNELS; i++)
+		{
+			if(servos[i].moving)
+				moving |= 1 << i;
+		}
+	}
+
+	return moving;
+}
+
+
+/**
+ * Number of readbacks that got no reply
+ */
+unsigned int parallax_get_read_misses(void)
+{
+	unsigned int n;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		n = read_misses;
+	}
+
+	return n;
+}
+
+
+/**
+ * Get the position command counts since startup, see servo_stats_t
+ */
+void parallax_get_stats(servo_stats_t *st)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*st = stats;
+	}
+}
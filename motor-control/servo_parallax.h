@@ -9,6 +9,11 @@
 #ifndef SERVO_PARALLAX_H_
 #define SERVO_PARALLAX_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
+//#define SERVO_USE_PWM								// Pulse the servos from TCE1 instead, see servo_pwm.h
+
 #define SERVO_LEFT_ARM_CHANNEL		0
 #define SERVO_RIGHT_ARM_CHANNEL		2
 #define SERVO_LEFT_GRIP_CHANNEL		1
@@ -27,9 +32,53 @@
 #define SERVO_ARM_RAMP				10
 #define SERVO_GRIP_RAMP				5
 
-#define SERVO_CLOSE_TIME			(100/MS_TIMER_PER)	// 100 ms
+#define SERVO_CLOSE_TIME			100					// ms
+
+/* The controller starts at 2400 baud and is switched to 38400 with !SCSBR */
+#define SERVO_BAUD_SLOW				2400
+#define SERVO_BAUD_FAST				38400
+#define SERVO_SWITCH_DELAY			10000				// us for the controller to change rate
+#define SERVO_REPLY_TIMEOUT			100000				// us from a query to the end of its reply
+
+/* Position readback with !SCRSP, for servos that haven't reached their target */
+#define SERVO_NUM_CHANNELS			16
+#define SERVO_POSITION_TOLERANCE	2					// Counts as at the target within this
+#define SERVO_READ_TIMEOUT			(100/MS_TIMER_PER)	// MS_TIMER ticks to wait for a reply
+#define SERVO_FRAME_SIZE			8					// Bytes in a !SC position command
+
+/**
+ * State of the serial link to the servo controller. The times are measured with
+ * a !SCVER? query, which is the same length as a !SC position command.
+ */
+typedef struct servo_link {
+	long baud;
+	bool verified;					// The controller answered at this rate
+	unsigned long int cmd_us;		// Queueing a command to its last byte sent
+	unsigned long int reply_us;		// Queueing a query to the end of its reply
+	char version[4];				// Firmware version the controller reported
+} servo_link_t;
+
+/**
+ * Position commands, counted by parallax_set_angle() and parallax_tick(). Each one
+ * merged or suppressed is SERVO_FRAME_SIZE bytes that weren't sent.
+ */
+typedef struct servo_stats {
+	unsigned int requested;			// Calls to parallax_set_angle()
+	unsigned int sent;				// Commands written to the controller
+	unsigned int merged;			// Replaced by a later one before being sent
+	unsigned int suppressed;		// Same angle and ramp as the last one sent
+	unsigned int bursts;			// Writes the sent ones went out in
+} servo_stats_t;
 
 void init_servo_parallax();
 int parallax_set_angle(int channel, int angle, int ramp);
+bool parallax_set_baud(long baud);
+void parallax_get_link(servo_link_t *l);
+void parallax_tick(void);
+void parallax_set_position(uint8_t channel, int angle);
+void parallax_get_positions(int *positions, uint8_t n);
+uint16_t parallax_get_moving(void);
+unsigned int parallax_get_read_misses(void);
+void parallax_get_stats(servo_stats_t *st);
 
 #endif /* SERVO_PARALLAX_H_ */
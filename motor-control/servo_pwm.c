@@ -0,0 +1,146 @@
+/*
+ * servo_pwm.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+#include "debug.h"
+#include "motor.h"
+#include "servo_parallax.h"
+#include "servo_pwm.h"
+
+#ifdef SERVO_USE_PWM
+
+#if NUM_MOTORS != 2
+#error "SERVO_USE_PWM takes TCE1, which measures motor c's encoder with four motors"
+#endif
+
+#define PIN_bm(channel)		(1 << (SERVO_PWM_PIN0 + (channel)))
+#define ALL_PINS_bm			(((1 << SERVO_PWM_CHANNELS) - 1) << SERVO_PWM_PIN0)
+
+typedef struct servo_pwm {
+	uint16_t position;		// Angle now, in 1/16ths
+	uint16_t target;		// Angle to ramp to, in 1/16ths
+	uint16_t step;			// 1/16ths per frame, 0 to jump straight there
+	bool on;				// Pulsed at all; off until the first angle is set
+	bool moving;
+} servo_pwm_t;
+
+static volatile servo_pwm_t servos[SERVO_PWM_CHANNELS];
+static volatile uint8_t slot = 0;
+
+
+/**
+ * Start the timer. Servos get no pulses until they're given an angle.
+ */
+void init_servo_pwm(void)
+{
+	// PORTB 4-7 are the JTAG pins (TMS, TDI, TCK, TDO), which override the port
+	// while JTAG is enabled. Programming over PDI still works with it off.
+	CCP = CCP_IOREG_gc;
+	MCU.MCUCR = MCU_JTAGD_bm;
+
+	SERVO_PWM_PORT.OUTCLR = ALL_PINS_bm;
+	SERVO_PWM_PORT.DIRSET = ALL_PINS_bm;
+
+	SERVO_PWM_TIMER.CTRLB = TC_WGMODE_NORMAL_gc;
+	SERVO_PWM_TIMER.CTRLD = TC_EVACT_OFF_gc | TC_EVSEL_OFF_gc;
+	SERVO_PWM_TIMER.PER = SERVO_PWM_SLOT - 1;
+	SERVO_PWM_TIMER.INTCTRLA = TC_OVFINTLVL_HI_gc;
+	SERVO_PWM_TIMER.INTCTRLB = TC_CCBINTLVL_HI_gc;
+	SERVO_PWM_TIMER.CTRLA = TC_CLKSEL_DIV64_gc;
+
+	PMIC.CTRL |= PMIC_HILVLEN_bm;
+	sei();
+}
+
+
+/**
+ * Send a servo to an angle, starting with its next pulse
+ *
+ * @param channel Servo channel (0 to SERVO_PWM_CHANNELS - 1)
+ * @param angle Angle (between 0 and 1000)
+ * @param ramp 0 to move at once, otherwise 1 (fast) to 63 (about a minute for
+ * 			   full travel), like the Parallax controller
+ * @return False if there's no such channel
+ */
+bool servo_pwm_set_angle(uint8_t channel, int angle, uint8_t ramp)
+{
+	volatile servo_pwm_t *s;
+
+	if(channel >= SERVO_PWM_CHANNELS)
+		return false;
+
+	s = &servos[channel];
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		s->target = angle << 4;
+		s->step = (ramp == 0) ? 0 : SERVO_PWM_RAMP_RATE / ramp;
+		if(! s->on)
+			s->position = s->target;		// Nothing to ramp from
+		s->on = true;
+		s->moving = true;
+	}
+
+	return true;
+}
+
+
+/**
+ * Move a servo one frame along its ramp
+ */
+static inline void ramp(volatile servo_pwm_t *s)
+{
+	if(s->step == 0 || s->position == s->target)
+		s->position = s->target;
+	else if(s->position < s->target)
+		s->position = (s->target - s->position > s->step) ? s->position + s->step : s->target;
+	else
+		s->position = (s->position - s->target > s->step) ? s->position - s->step : s->target;
+}
+
+
+/**
+ * Start of a slot: raise the slot's pin and set compare B to drop it
+ */
+ISR(SERVO_PWM_OVF_VECT)
+{
+	volatile servo_pwm_t *s;
+
+	DEBUG_ENTER_ISR(DEBUG_ISR_SERVO);
+
+	slot = (slot + 1) % SERVO_PWM_CHANNELS;
+	s = &servos[slot];
+	if(s->on)
+	{
+		SERVO_PWM_PORT.OUTSET = PIN_bm(slot);
+		SERVO_PWM_TIMER.CCB = SERVO_PWM_OFFSET + (s->position >> 4);
+
+		/* The next pulse is the one the ramp moves */
+		ramp(s);
+		if(s->moving)
+		{
+			parallax_set_position(slot, s->position >> 4);
+			s->moving = (s->position != s->target);
+		}
+	}
+
+	DEBUG_EXIT_ISR(DEBUG_ISR_SERVO);
+}
+
+
+/**
+ * End of the pulse
+ */
+ISR(SERVO_PWM_CCB_VECT)
+{
+	DEBUG_ENTER_ISR(DEBUG_ISR_SERVO);
+	SERVO_PWM_PORT.OUTCLR = ALL_PINS_bm;
+	DEBUG_EXIT_ISR(DEBUG_ISR_SERVO);
+}
+
+#endif /* SERVO_USE_PWM */
@@ -0,0 +1,35 @@
+/*
+ * servo_pwm.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Servo pulses generated directly, for when SERVO_USE_PWM is defined in
+ * servo_parallax.h. TCE1 runs in 5 ms slots, one per servo, so each servo gets a
+ * pulse every 20 ms. The overflow raises the slot's pin and compare B drops it,
+ * both at high priority so other interrupts don't stretch the pulse. Angles and
+ * ramps match parallax_set_angle(), and ramping is done here once per frame.
+ *
+ * TCE1 measures motor c's encoder with four motors, so this needs NUM_MOTORS == 2.
+ * The outputs share PORTB 4-7 with JTAG, so init_servo_pwm() disables JTAG.
+ */
+
+#ifndef SERVO_PWM_H_
+#define SERVO_PWM_H_
+
+#include <avr/io.h>
+#include <stdbool.h>
+
+#define SERVO_PWM_TIMER				TCE1
+#define SERVO_PWM_OVF_VECT			TCE1_OVF_vect
+#define SERVO_PWM_CCB_VECT			TCE1_CCB_vect
+#define SERVO_PWM_PORT				PORTB
+#define SERVO_PWM_PIN0				4			// Channel n is on pin SERVO_PWM_PIN0 + n
+#define SERVO_PWM_CHANNELS			4
+#define SERVO_PWM_SLOT				2500		// 5 ms at clock / 64
+#define SERVO_PWM_OFFSET			250			// Counts (2 us) at angle 0, as on the Parallax
+#define SERVO_PWM_RAMP_RATE			320			// 1/16 counts per frame at ramp 1, about 1 s full travel
+
+void init_servo_pwm(void);
+bool servo_pwm_set_angle(uint8_t channel, int angle, uint8_t ramp);
+
+#endif /* SERVO_PWM_H_ */
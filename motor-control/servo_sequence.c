@@ -0,0 +1,153 @@
+/*
+ * servo_sequence.c
+ *
+ *  Created on: Oct 19, 2026
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
+#include "uart.h"
+#include "timer.h"
+#include "json.h"
+#include "servo_parallax.h"
+#include "servo_sequence.h"
+
+#define SEQUENCE_LENGTH(steps)		(sizeof(steps)/sizeof(servo_step_t))
+
+typedef struct runner {
+	const servo_sequence_t *seq;	// NULL if idle
+	uint8_t step;					// Next step to send
+	unsigned int wait;				// MS_TIMER ticks until the next step
+	uint16_t channels;				// Servos the sequence moves
+	int id;							// Command to answer when done
+} runner_t;
+
+static const servo_step_t left_grab_steps[] = {
+	{SERVO_LEFT_GRIP_CHANNEL, SERVO_LEFT_GRIP_CLOSE, SERVO_GRIP_RAMP, SERVO_CLOSE_TIME},
+	{SERVO_LEFT_ARM_CHANNEL, SERVO_LEFT_ARM_UP, SERVO_ARM_RAMP, 0}
+};
+
+static const servo_step_t left_drop_steps[] = {
+	{SERVO_LEFT_ARM_CHANNEL, SERVO_LEFT_ARM_DOWN, SERVO_ARM_RAMP, 0},
+	{SERVO_LEFT_GRIP_CHANNEL, SERVO_LEFT_GRIP_OPEN, SERVO_GRIP_RAMP, 0}
+};
+
+static const servo_step_t right_grab_steps[] = {
+	{SERVO_RIGHT_GRIP_CHANNEL, SERVO_RIGHT_GRIP_CLOSE, SERVO_GRIP_RAMP, SERVO_CLOSE_TIME},
+	{SERVO_RIGHT_ARM_CHANNEL, SERVO_RIGHT_ARM_UP, SERVO_ARM_RAMP, 0}
+};
+
+static const servo_step_t right_drop_steps[] = {
+	{SERVO_RIGHT_ARM_CHANNEL, SERVO_RIGHT_ARM_DOWN, SERVO_ARM_RAMP, 0},
+	{SERVO_RIGHT_GRIP_CHANNEL, SERVO_RIGHT_GRIP_OPEN, SERVO_GRIP_RAMP, 0}
+};
+
+const servo_sequence_t servo_left_grab = {left_grab_steps, SEQUENCE_LENGTH(left_grab_steps)};
+const servo_sequence_t servo_left_drop = {left_drop_steps, SEQUENCE_LENGTH(left_drop_steps)};
+const servo_sequence_t servo_right_grab = {right_grab_steps, SEQUENCE_LENGTH(right_grab_steps)};
+const servo_sequence_t servo_right_drop = {right_drop_steps, SEQUENCE_LENGTH(right_drop_steps)};
+
+static volatile runner_t runners[SERVO_SEQUENCE_RUNNERS];
+
+
+/**
+ * Start a sequence in the background. Its first step goes out on the next
+ * MS_TIMER tick.
+ *
+ * @param seq Sequence to run
+ * @param id Command id to answer when the sequence is done
+ * @return False if a running sequence uses the same servos, or none are idle
+ */
+bool servo_sequence_start(const servo_sequence_t *seq, int id)
+{
+	uint16_t channels = 0;
+	uint16_t busy = 0;
+	volatile runner_t *idle = NULL;
+	uint8_t i;
+
+	for(i = 0; i < seq->num_steps; i++)
+		channels |= 1 << seq->steps[i].channel;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < SERVO_SEQUENCE_RUNNERS; i++)
+		{
+			if(runners[i].seq != NULL)
+				busy |= runners[i].channels;
+			else if(idle == NULL)
+				idle = &runners[i];
+		}
+
+		if(idle != NULL && ! (busy & channels))
+		{
+			idle->step = 0;
+			idle->wait = 0;
+			idle->channels = channels;
+			idle->id = id;
+			idle->seq = seq;
+		}
+		else
+		{
+			idle = NULL;
+		}
+	}
+
+	return idle != NULL;
+}
+
+
+/**
+ * Send the steps that are due and answer finished sequences. Called every
+ * MS_TIMER tick. A finished sequence waits for any other JSON response to end,
+ * and for room for its answer in the debug UART's buffer, before it answers.
+ */
+void servo_sequence_tick(void)
+{
+	volatile runner_t *r;
+	const servo_step_t *s;
+	uint8_t i;
+
+	for(i = 0; i < SERVO_SEQUENCE_RUNNERS; i++)
+	{
+		r = &runners[i];
+		if(r->seq == NULL)
+			continue;
+
+		if(r->wait > 0 && --r->wait > 0)
+			continue;
+
+		while(r->wait == 0 && r->step < r->seq->num_steps)
+		{
+			s = &r->seq->steps[r->step++];
+			parallax_set_angle(s->channel, s->angle, s->ramp);
+			r->wait = (s->delay + MS_TIMER_PER - 1) / MS_TIMER_PER;
+		}
+
+		if(r->wait == 0 && ! json_in_response()
+		   && buffer_free(&debug_uart.write_buffer) >= SERVO_SEQUENCE_LINE_MAX)
+		{
+			json_respond_ok("", r->id);
+			r->seq = NULL;
+		}
+	}
+}
+
+
+/**
+ * True while any sequence is running
+ */
+bool servo_sequence_busy(void)
+{
+	uint8_t i;
+
+	for(i = 0; i < SERVO_SEQUENCE_RUNNERS; i++)
+	{
+		if(runners[i].seq != NULL)
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,41 @@
+/*
+ * servo_sequence.h
+ *
+ *  Created on: Oct 19, 2026
+ *
+ * Timed servo moves run in the background. A sequence is a table of steps, each
+ * sent to the Parallax controller and followed by a delay before the next one.
+ * The MS_TIMER interrupt steps through every running sequence and, after the last
+ * step's delay, answers the command that started it with an ok response carrying
+ * that command's id. Sequences on different servos run at the same time.
+ */
+
+#ifndef SERVO_SEQUENCE_H_
+#define SERVO_SEQUENCE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SERVO_SEQUENCE_RUNNERS		2		// Sequences that can run at once
+#define SERVO_SEQUENCE_LINE_MAX		40		// Longest ok response from servo_sequence_tick()
+
+typedef struct servo_step {
+	uint8_t channel;
+	int angle;
+	uint8_t ramp;
+	unsigned int delay;			// ms to wait after this step
+} servo_step_t;
+
+typedef struct servo_sequence {
+	const servo_step_t *steps;
+	uint8_t num_steps;
+} servo_sequence_t;
+
+extern const servo_sequence_t servo_left_grab, servo_left_drop;
+extern const servo_sequence_t servo_right_grab, servo_right_drop;
+
+bool servo_sequence_start(const servo_sequence_t *seq, int id);
+void servo_sequence_tick(void);
+bool servo_sequence_busy(void);
+
+#endif /* SERVO_SEQUENCE_H_ */
@@ -6,12 +6,22 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <stdbool.h>
 #include "motor.h"
 #include "debug.h"
+#include "i2c.h"
+#include "sensors.h"
+#include "heading.h"
+#include "odometry.h"
+#include "event.h"
+#include "servo_parallax.h"
+#include "servo_sequence.h"
+#include "ultrasonic.h"
 #include "timer.h"
 
 volatile uint16_t ms_timer = 0;
+volatile unsigned long int tick_count = 0;		// MS_TIMER ticks since boot. Unlike ms_timer, never reset.
 
 /**
  * Initializes a PWM timer
@@ -90,30 +100,151 @@ void init_ms_timer(void)
 }
 
 
+/**
+ * Returns the number of MS_TIMER ticks since boot. Used to timestamp sensor data.
+ */
+unsigned long int get_tick_count(void)
+{
+	unsigned long int ticks;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks = tick_count;
+	}
+
+	return ticks;
+}
+
+
+/**
+ * Microseconds since boot, from tick_count and the MS_TIMER count (2 us per count).
+ * Wraps after about 71 minutes, so only use it for differences.
+ */
+unsigned long int timer_get_us(void)
+{
+	unsigned long int ticks;
+	uint16_t cnt;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		cnt = MS_TIMER.CNT;
+		ticks = tick_count;
+
+		/* Overflowed, but the interrupt hasn't counted it yet */
+		if(MS_TIMER.INTFLAGS & TC0_OVFIF_bm)
+		{
+			cnt = MS_TIMER.CNT;
+			ticks++;
+		}
+	}
+
+	return ticks * MS_TIMER_PER * 1000 + (unsigned long)cnt * 2;
+}
+
+
+static void empty_function(void)
+{
+}
+
+
+/**
+ * Count MS_TIMER clocks across a number of calls to a function, with interrupts off.
+ */
+static unsigned long int count_timer_clocks(void (*function)(void), uint8_t iterations)
+{
+	uint16_t start, end;
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		start = MS_TIMER.CNT;
+		for(i = 0; i < iterations; i++)
+			function();
+		end = MS_TIMER.CNT;
+	}
+
+	/* The timer counts 0..PER, so it can have wrapped once */
+	if(end >= start)
+		return end - start;
+	else
+		return (unsigned long)end + MS_TIMER.PER + 1 - start;
+}
+
+
+/**
+ * Measure the average CPU cycles a function takes, using MS_TIMER as the clock. The
+ * cost of the call itself is subtracted.
+ *
+ * Interrupts are off while measuring and the timer must not wrap more than once, so
+ * iterations * cycles has to stay under one MS_TIMER period (160000 cycles). The
+ * result is accurate to 64 / iterations cycles.
+ *
+ * @param function Function to time
+ * @param iterations Number of calls to average over
+ * @return Cycles per call
+ */
+unsigned int timer_measure_cycles(void (*function)(void), uint8_t iterations)
+{
+	unsigned long int clocks = count_timer_clocks(function, iterations);
+	unsigned long int overhead = count_timer_clocks(empty_function, iterations);
+
+	if(iterations == 0 || clocks < overhead)
+		return 0;
+
+	return ((clocks - overhead) * 64) / iterations;		// MS_TIMER runs at CPU clock / 64
+}
+
+
 /**
  * MS_TIMER interrupt service routine
  */
 ISR(TCC0_OVF_vect)
 {
+	unsigned int stops;
+
 	DEBUG_ENTER_ISR(DEBUG_ISR_MSTIMER);
 
 	ms_timer++;
+	tick_count++;
+	i2c_tick();
+	sensors_tick();
+	heading_tick();
+	odometry_tick();
 
-	if(pid_is_enabled())
+	if(pid_is_enabled() && ! pid_is_paused())
 	{
+		stops = ultrasonic_get_stops();
 		compute_next_pid_iteration();
 
+		/* The ultrasonic obstacle and drop stops can brake in the middle of the
+		 * iteration, which mustn't be undone.
+		 */
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if(stops != ultrasonic_get_stops())
+			{
+				brake_motors();
+			}
+			else
+			{
 #if NUM_MOTORS == 4
-		update_speed(&MOTOR_LEFT_FRONT);
-		update_speed(&MOTOR_LEFT_BACK);
-		update_speed(&MOTOR_RIGHT_FRONT);
-		update_speed(&MOTOR_RIGHT_BACK);
+				update_speed(&MOTOR_LEFT_FRONT);
+				update_speed(&MOTOR_LEFT_BACK);
+				update_speed(&MOTOR_RIGHT_FRONT);
+				update_speed(&MOTOR_RIGHT_BACK);
 #elif NUM_MOTORS == 2
-		update_speed(&MOTOR_LEFT);
-		update_speed(&MOTOR_RIGHT);
+				update_speed(&MOTOR_LEFT);
+				update_speed(&MOTOR_RIGHT);
 #endif
+			}
+		}
 	}
 
+	pid_abort_tick();
+	servo_sequence_tick();
+	parallax_tick();
+	event_tick();
+
 	DEBUG_EXIT_ISR(DEBUG_ISR_MSTIMER);
 }
 
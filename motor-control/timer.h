@@ -12,9 +12,13 @@
 #define MS_TIMER_PER	5		// Period of MS_TIMER in milliseconds
 
 extern volatile uint16_t ms_timer;
+extern volatile unsigned long int tick_count;
 
 void init_pwm_timer(TC0_t *timer);
 void init_enc_timer(TC1_t *timer, TC_EVSEL_t event_channel);
 void init_ms_timer(void);
+unsigned long int get_tick_count(void);
+unsigned long int timer_get_us(void);
+unsigned int timer_measure_cycles(void (*function)(void), uint8_t iterations);
 
 #endif /* TIMER_H_ */
@@ -84,7 +84,7 @@ typedef enum TWIM_RESULT_enum {
 
 /*! Buffer size defines */
 #define TWIM_WRITE_BUFFER_SIZE         8
-#define TWIM_READ_BUFFER_SIZE          8
+#define TWIM_READ_BUFFER_SIZE          24	/* Accelerometer FIFO burst */
 
 
 /*! \brief TWI master driver struct
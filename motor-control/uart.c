@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "buffer.h"
 #include "debug.h"
 #include "uart.h"
@@ -41,8 +42,7 @@ void init_uart(uart_t *u, USART_t *usart, uint16_t bsel, int8_t bscale)
 			   	 | USART_PMODE_DISABLED_gc
 			   	 | USART_CHSIZE_8BIT_gc;
 
-	usart->BAUDCTRLA = bsel & 0xff;
-	usart->BAUDCTRLB = ((bsel >> 8) & 0x0f) | ((bscale << 4) & 0xf0);
+	uart_set_baud(u, bsel, bscale);
 
 	// Attach the uart_t struct to the file streams. This is so that uart_putchar and uart_getchar
 	// know which buffer to use.
@@ -56,6 +56,21 @@ void init_uart(uart_t *u, USART_t *usart, uint16_t bsel, int8_t bscale)
 }
 
 
+/**
+ * Change the baud rate of a UART. Anything still being sent goes out at the new
+ * rate, so wait for the write buffer to drain first.
+ *
+ * @param u UART
+ * @param bsel Baud rate select, see the XMEGA A manual
+ * @param bscale Baud rate scale
+ */
+void uart_set_baud(uart_t *u, uint16_t bsel, int8_t bscale)
+{
+	u->usart->BAUDCTRLA = bsel & 0xff;
+	u->usart->BAUDCTRLB = ((bsel >> 8) & 0x0f) | ((bscale << 4) & 0xf0);
+}
+
+
 //#define NEW_INIT
 /**
  * Initializes the UART. stdio.h won't work until this function is called.
@@ -114,6 +129,36 @@ int uart_putchar(char c, FILE *f)
 }
 
 
+/**
+ * Queue a block of bytes for the UART in one go, or none of them if they don't all
+ * fit. Never waits, so it can be used from interrupts that mustn't stall.
+ *
+ * @param u UART to transmit on
+ * @param data Bytes to transmit
+ * @param num_bytes Number of bytes
+ *
+ * @return True if the bytes were queued
+ */
+bool uart_write(uart_t *u, const uint8_t *data, uint8_t num_bytes)
+{
+	bool queued = false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(buffer_free(&(u->write_buffer)) >= num_bytes)
+		{
+			while(num_bytes-- > 0)
+				buffer_put(&(u->write_buffer), *data++);
+
+			u->usart->CTRLA = (u->usart->CTRLA & ~USART_DREINTLVL_gm) | UART_DREINTLVL;
+			queued = true;
+		}
+	}
+
+	return queued;
+}
+
+
 /**
  * Read a character from the UART. This function is connected to the uart_in FILE stream,
  * which is set to stdin.
@@ -12,6 +12,7 @@
 #define SERIAL_STDIO_H_
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <avr/io.h>
 #include "buffer.h"
 
@@ -38,8 +39,10 @@ typedef struct uart {
 } uart_t;
 
 void init_uart(uart_t *u, USART_t *usart, uint16_t bsel, int8_t bscale);
+void uart_set_baud(uart_t *u, uint16_t bsel, int8_t bscale);
 void init_uarts();
 int uart_putchar(char c, FILE *f);
+bool uart_write(uart_t *u, const uint8_t *data, uint8_t num_bytes);
 int uart_getchar(FILE *f);
 
 extern uart_t debug_uart, pandaboard_uart, servo_uart;
@@ -10,14 +10,54 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include "debug.h"
+#include "sensors.h"
+#include "motor.h"
+#include "pid.h"
+#include "timer.h"
+#include "event.h"
 #include "ultrasonic.h"
 
-#define CURRENT_SENSOR			(usensors[current_sensor])
-#define NEXT_SENSOR_INDEX()		((current_sensor+1) % ULTRASONIC_NUM_SENSORS)
+#define NO_SENSOR				0xff
+#define CAPTURE(channel)		((&ULTRASONIC_TIMER.CCA)[channel])
+#define CHMUX(channel)			((&ULTRASONIC_CHMUX)[channel])
+#define CAPTURE_RISING_bm		0x8000		// Edge polarity, set in captures while PER < 0x8000
+
+#define SENSOR_bm(id)			(1 << (id))
+
+/**
+ * Sensors that hear each other's pings and so can't share a slot. Opposite sides
+ * don't, and the bottom sensor points at the floor and hears nobody.
+ */
+static const uint8_t conflicts[ULTRASONIC_NUM_SENSORS] = {
+	[ULTRASONIC_LEFT] = SENSOR_bm(ULTRASONIC_FRONT) | SENSOR_bm(ULTRASONIC_BACK),
+	[ULTRASONIC_FRONT] = SENSOR_bm(ULTRASONIC_LEFT) | SENSOR_bm(ULTRASONIC_RIGHT),
+	[ULTRASONIC_BOTTOM] = 0,
+	[ULTRASONIC_RIGHT] = SENSOR_bm(ULTRASONIC_FRONT) | SENSOR_bm(ULTRASONIC_BACK),
+	[ULTRASONIC_BACK] = SENSOR_bm(ULTRASONIC_LEFT) | SENSOR_bm(ULTRASONIC_RIGHT)
+};
+
+/**
+ * How often each sensor is pinged while the robot is doing each thing, 0 to
+ * ULTRASONIC_MAX_WEIGHT. 0 turns the sensor off.
+ */
+static uint8_t weights[ULTRASONIC_NUM_MOTIONS][ULTRASONIC_NUM_SENSORS] = {
+	/* Left, front, bottom, right, back */
+	{1, 1, 1, 1, 1},		// ULTRASONIC_MOTION_STOPPED
+	{1, 4, 2, 1, 0},		// ULTRASONIC_MOTION_FORWARD
+	{1, 0, 2, 1, 4},		// ULTRASONIC_MOTION_REVERSE
+	{3, 1, 1, 3, 1}			// ULTRASONIC_MOTION_TURNING
+};
 
 volatile ultrasonic_t usensors[ULTRASONIC_NUM_SENSORS];
-volatile unsigned char current_sensor = ULTRASONIC_LEFT;
-volatile bool measurement_in_progress = false;
+static volatile uint8_t slot[ULTRASONIC_NUM_CHANNELS];		// Sensor on each capture channel
+static volatile ultrasonic_motion_t motion = ULTRASONIC_MOTION_STOPPED;
+static unsigned long int rates_since = 0;
+static volatile uint16_t stop_base = 0;			// Ticks, 0 if the obstacle stop is off
+static volatile uint16_t stop_full = 0;			// Ticks added at full speed
+static volatile unsigned int stops = 0;
+static volatile uint16_t stop_worst = 0;		// Longest echo to brake time, ticks
+static volatile unsigned int drop_rise = 0;		// mm, 0 if drop detection is off
+static volatile uint8_t drop_readings = 0;		// Consecutive bottom readings past the floor
 
 
 /**
@@ -35,6 +75,8 @@ static inline void init_ultrasonic_struct(volatile ultrasonic_t *u,
 					 	 				  uint8_t echo_bm,
 					 	 				  EVSYS_CHMUX_t echo_chmux)
 {
+	uint8_t i;
+
 	port->OUTSET = trig_bm;		// Set trigger high (falling edge triggered)
 	port->DIRSET = trig_bm;		// Set trigger as output
 	port->DIRCLR = echo_bm;		// Set echo as input
@@ -44,34 +86,406 @@ static inline void init_ultrasonic_struct(volatile ultrasonic_t *u,
 	u->echo_bm = echo_bm;
 	u->echo_chmux = echo_chmux;
 	u->distance = -1;
+	u->max_range = ULTRASONIC_TIMEOUT;
+	u->measuring = false;
+	u->credit = 0;
+	u->pings = 0;
+	for(i = 0; i < ULTRASONIC_HISTORY; i++)
+		u->history[i] = ULTRASONIC_NO_ECHO;
+	u->history_index = 0;
+	u->rejects = 0;
+	u->reading.mm = -1;
+	u->reading.valid = false;
+	u->reading.time = 0;
 }
 
 
 /**
- * Trigger an ultrasonic sensor measurement
+ * Signed drive of a motor: positive forward, negative reverse, 0 if braking
+ */
+static inline int signed_pwm(motor_t *m)
+{
+	if(m->response.dir == DIR_FORWARD)
+		return m->response.pwm;
+	else if(m->response.dir == DIR_REVERSE)
+		return -m->response.pwm;
+
+	return 0;
+}
+
+
+/**
+ * Work out which way the robot is going from what the motors are being driven
+ * with. Before the PID loop has ramped the motors up, its setpoint says where the
+ * robot is about to go.
+ */
+static ultrasonic_motion_t get_motion(void)
+{
+#if NUM_MOTORS == 4
+	int left = signed_pwm(&MOTOR_LEFT_FRONT);
+	int right = signed_pwm(&MOTOR_RIGHT_FRONT);
+#elif NUM_MOTORS == 2
+	int left = signed_pwm(&MOTOR_LEFT);
+	int right = signed_pwm(&MOTOR_RIGHT);
+#endif
+
+	if(left == 0 && right == 0 && pid_is_enabled())
+		left = right = pid_get_motor_setpoint();
+
+	if(left == 0 && right == 0)
+		return ULTRASONIC_MOTION_STOPPED;
+	else if(left > 0 && right > 0)
+		return ULTRASONIC_MOTION_FORWARD;
+	else if(left < 0 && right < 0)
+		return ULTRASONIC_MOTION_REVERSE;
+
+	return ULTRASONIC_MOTION_TURNING;
+}
+
+
+/**
+ * Signed drive of the robot along its length, -PWM_PERIOD to PWM_PERIOD. Turning in
+ * place comes out near 0.
+ */
+static inline int get_drive(void)
+{
+#if NUM_MOTORS == 4
+	return (signed_pwm(&MOTOR_LEFT_FRONT) + signed_pwm(&MOTOR_RIGHT_FRONT)) / 2;
+#elif NUM_MOTORS == 2
+	return (signed_pwm(&MOTOR_LEFT) + signed_pwm(&MOTOR_RIGHT)) / 2;
+#endif
+}
+
+
+/**
+ * Choose the sensors for the next slot. Every sensor earns its weight in credit
+ * each slot and is reset to 0 when pinged. The sensor with the most credit is
+ * pinged, along with every other sensor with a weight that doesn't conflict with
+ * those already chosen, so the slot is never wasted on one sensor.
+ */
+static inline void schedule_slot(void)
+{
+	const uint8_t *w;
+	uint8_t excluded = 0;
+	uint8_t channel = 0;
+	uint8_t best;
+	uint8_t i;
+
+	motion = get_motion();
+	w = weights[motion];
+
+	/* Drop detection needs the bottom sensor every slot while moving, whatever its
+	 * weight. It conflicts with nothing, so it costs no other sensor its turn.
+	 */
+	if(drop_rise != 0 && motion != ULTRASONIC_MOTION_STOPPED)
+	{
+		excluded = SENSOR_bm(ULTRASONIC_BOTTOM) | conflicts[ULTRASONIC_BOTTOM];
+		usensors[ULTRASONIC_BOTTOM].credit = 0;
+		slot[channel++] = ULTRASONIC_BOTTOM;
+	}
+
+	for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+	{
+		if(usensors[i].credit <= 0xff - w[i])
+			usensors[i].credit += w[i];
+	}
+
+	while(channel < ULTRASONIC_NUM_CHANNELS)
+	{
+		best = NO_SENSOR;
+		for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+		{
+			if(w[i] == 0 || (excluded & SENSOR_bm(i)))
+				continue;
+			if(best == NO_SENSOR || usensors[i].credit > usensors[best].credit)
+				best = i;
+		}
+
+		if(best == NO_SENSOR)
+			break;
+
+		excluded |= SENSOR_bm(best) | conflicts[best];
+		usensors[best].credit = 0;
+		slot[channel++] = best;
+	}
+
+	while(channel < ULTRASONIC_NUM_CHANNELS)
+		slot[channel++] = NO_SENSOR;
+}
+
+
+/**
+ * Trigger the measurements of the current slot, each on its own capture channel.
+ *
+ * The slot lasts only as long as the longest range in it needs. A sensor whose
+ * echo line is still high from a previous out-of-range ping can't be triggered,
+ * so it sits this slot out.
  */
 static inline void ping_ultrasonic(void)
 {
-	volatile ultrasonic_t *u = &CURRENT_SENSOR;
+	volatile ultrasonic_t *u;
+	uint16_t window = 0;
+	uint8_t channel;
+	uint8_t sensor;
+
+	for(channel = 0; channel < ULTRASONIC_NUM_CHANNELS; channel++)
+	{
+		sensor = slot[channel];
+		if(sensor == NO_SENSOR)
+			continue;
+
+		u = &usensors[sensor];
+		if(u->port->IN & u->echo_bm)
+			continue;
+
+		u->pings++;
+		u->measuring = true;
+		u->rise_seen = false;
+		CHMUX(channel) = u->echo_chmux;			// Connect the event channel to the echo pin
+		u->port->OUTCLR = u->trig_bm;			// Falling edge triggers sensor measurement
+
+		if(u->max_range > window)
+			window = u->max_range;
+	}
+
+	ULTRASONIC_TIMER.PER = (window > 0) ? ULTRASONIC_ECHO_DELAY + window : ULTRASONIC_SETTLE;
+}
+
+
+/**
+ * Once every sensor in the slot has answered, cut it short, leaving
+ * ULTRASONIC_SETTLE for stray echoes to die down.
+ */
+static inline void end_slot_if_done(void)
+{
+	uint8_t channel;
+	uint8_t sensor;
+
+	for(channel = 0; channel < ULTRASONIC_NUM_CHANNELS; channel++)
+	{
+		sensor = slot[channel];
+		if(sensor != NO_SENSOR && usensors[sensor].measuring)
+			return;
+	}
+
+	if(ULTRASONIC_TIMER.CNT + ULTRASONIC_SETTLE < ULTRASONIC_TIMER.PER)
+		ULTRASONIC_TIMER.CNT = ULTRASONIC_TIMER.PER - ULTRASONIC_SETTLE;
+}
+
+
+/**
+ * Add a measurement to a sensor's filtered reading.
+ *
+ * A reading further from the current one than the robot or an obstacle could
+ * plausibly have moved since is dropped, unless ULTRASONIC_MAX_REJECTS in a row
+ * agree that something really changed. What gets through goes into a short
+ * history, and the median of that is the reading.
+ *
+ * @param u Sensor
+ * @param result Echo length in timer ticks, or -1 if out of range
+ */
+static inline void filter(volatile ultrasonic_t *u, int result)
+{
+	int16_t sorted[ULTRASONIC_HISTORY];
+	int16_t mm = (result < 0) ? ULTRASONIC_NO_ECHO : ULTRASONIC_TICKS_TO_MM(result);
+	unsigned long int dt;
+	long limit;
+	int16_t v;
+	uint8_t i, j;
+
+	if(u->reading.valid && mm != ULTRASONIC_NO_ECHO)
+	{
+		dt = (tick_count - u->reading.time) * MS_TIMER_PER;
+		if(dt > 1000)
+			dt = 1000;
+		limit = ULTRASONIC_NOISE + (long)ULTRASONIC_MAX_RATE * dt / 1000;
 
-	measurement_in_progress = true;
-	ULTRASONIC_TIMER.CCA = 0;
-	ULTRASONIC_CHMUX = u->echo_chmux;			// Connect event channel 4 to echo pin
-	u->port->OUTCLR = u->trig_bm;				// Falling edge triggers sensor measurement
+		if(labs((long)mm - u->reading.mm) > limit)
+		{
+			if(u->rejects < ULTRASONIC_MAX_REJECTS)
+			{
+				u->rejects++;
+				return;
+			}
+
+			/* It's real, start over at the new distance */
+			for(i = 0; i < ULTRASONIC_HISTORY; i++)
+				u->history[i] = mm;
+		}
+	}
+	u->rejects = 0;
+
+	u->history[u->history_index] = mm;
+	u->history_index = (u->history_index + 1) % ULTRASONIC_HISTORY;
+
+	/* Insertion sort, it's three values */
+	for(i = 0; i < ULTRASONIC_HISTORY; i++)
+	{
+		v = u->history[i];
+		for(j = i; j > 0 && sorted[j-1] > v; j--)
+			sorted[j] = sorted[j-1];
+		sorted[j] = v;
+	}
+
+	v = sorted[ULTRASONIC_HISTORY / 2];
+	u->reading.valid = (v != ULTRASONIC_NO_ECHO);
+	u->reading.mm = u->reading.valid ? v : -1;
+	u->reading.time = tick_count;
+}
+
+
+/**
+ * Stop the robot from an interrupt. Counting the stop tells the MS_TIMER interrupt
+ * not to apply a PID iteration that was under way. A long command that was moving
+ * the robot is answered with reason as the error.
+ */
+static inline void halt(const char *reason)
+{
+	pid_abort(reason);
+	brake_motors();
+	stops++;
+}
+
+
+/**
+ * Brake if the bottom sensor reads further than the floor has been, or gets no
+ * echo, ULTRASONIC_DROP_CONFIRM times in a row. This runs before the new reading
+ * is filtered, so the floor is still the old one.
+ *
+ * @param u Bottom sensor
+ * @param result Echo length in timer ticks, or -1 if out of range. Echoes shorter
+ * 		  than ULTRASONIC_MIN_ECHO are noise, not a drop, and are ignored.
+ */
+static inline void check_drop(volatile ultrasonic_t *u, int result)
+{
+	int mm;
+
+	if(drop_rise == 0 || ! u->reading.valid || get_drive() == 0)
+	{
+		drop_readings = 0;
+		return;
+	}
+
+	if(result >= 0 && result < ULTRASONIC_MIN_ECHO)
+		return;
+
+	mm = (result < 0) ? -1 : (int)ULTRASONIC_TICKS_TO_MM(result);
+	if(mm >= 0 && mm < u->reading.mm + (int)drop_rise)
+	{
+		drop_readings = 0;
+		return;
+	}
+
+	if(++drop_readings < ULTRASONIC_DROP_CONFIRM)
+		return;
+	drop_readings = 0;
+
+	halt("drop");
+	event_post_value(EVENT_DROP, mm, u->reading.mm);
 }
 
 
 /**
  * Set the result of a sensor measurement, and reset for the next run
+ *
+ * @param sensor Sensor
+ * @param result Echo length in timer ticks, or -1 if out of range
  */
-static inline void set_result(int result)
+static inline void set_result(uint8_t sensor, int result)
 {
-	volatile ultrasonic_t *u = &CURRENT_SENSOR;
+	volatile ultrasonic_t *u = &usensors[sensor];
 
-	u->distance = (result == 1) ? -1 : result;	// This is a kludge to fix a problem I don't fully understand.
-	u->port->OUTSET = usensors[current_sensor].trig_bm;
-	current_sensor = NEXT_SENSOR_INDEX();
-	measurement_in_progress = false;
+	if(sensor == ULTRASONIC_BOTTOM)
+		check_drop(u, result);
+
+	/* Noise is reported as out of range, but isn't evidence that nothing is there */
+	if(result >= 0 && result < ULTRASONIC_MIN_ECHO)
+	{
+		u->distance = -1;
+	}
+	else
+	{
+		u->distance = result;
+		filter(u, result);
+	}
+	sensors_update_ultrasonic(sensor, u->distance, (ultrasonic_reading_t *)&u->reading);
+	u->port->OUTSET = u->trig_bm;
+	u->measuring = false;
+}
+
+
+/**
+ * Brake if a sensor facing the way the robot is driving sees something inside the
+ * stopping distance. This runs straight from the capture interrupt so the host is
+ * not in the loop; the host hears about it from an "obstacle" event.
+ *
+ * @param sensor Sensor
+ * @param echo Echo length in timer ticks
+ * @param fall Capture of the end of the echo, to time the reaction
+ */
+static inline void check_obstacle(uint8_t sensor, uint16_t echo, uint16_t fall)
+{
+	int drive;
+	uint16_t threshold;
+	uint16_t now, reaction;
+
+	if(stop_base == 0)
+		return;
+
+	drive = get_drive();
+	if(! ((sensor == ULTRASONIC_FRONT && drive > 0) || (sensor == ULTRASONIC_BACK && drive < 0)))
+		return;
+
+	threshold = stop_base + (unsigned long)stop_full * abs(drive) / PWM_PERIOD;
+	if(echo > threshold)
+		return;
+
+	halt("obstacle");
+
+	/* The counter may have overflowed since the capture, but not twice */
+	now = ULTRASONIC_TIMER.CNT;
+	reaction = now - fall;
+	if(now < fall)
+		reaction += ULTRASONIC_TIMER.PER + 1;
+	if(reaction > stop_worst)
+		stop_worst = reaction;
+
+	event_post(EVENT_OBSTACLE, ULTRASONIC_TICKS_TO_MM(echo));
+}
+
+
+/**
+ * Handle an echo edge captured on one channel. The start of the echo is
+ * remembered; the end completes the measurement.
+ */
+static inline void capture(uint8_t channel)
+{
+	uint16_t cc = CAPTURE(channel);
+	uint16_t fall;
+	uint8_t sensor = slot[channel];
+	volatile ultrasonic_t *u;
+
+	if(sensor == NO_SENSOR)
+		return;
+
+	u = &usensors[sensor];
+	if(! u->measuring)
+		return;
+
+	if(cc & CAPTURE_RISING_bm)
+	{
+		u->rise = cc & ~CAPTURE_RISING_bm;
+		u->rise_seen = true;
+	}
+	else if(u->rise_seen)
+	{
+		fall = cc;
+		cc -= u->rise;
+		set_result(sensor, (cc <= u->max_range) ? (int)cc : -1);
+		if(u->distance > 0)
+			check_obstacle(sensor, cc, fall);
+		end_slot_if_done();
+	}
 }
 
 
@@ -106,12 +520,16 @@ void init_ultrasonic()
 						   ULTRASONIC_BACK_ECHO,
 						   ULTRASONIC_BACK_CHMUX);
 
-	/* Initialize ultrasonic timer */
-	ULTRASONIC_TIMER.CTRLB = TC0_CCAEN_bm | TC_WGMODE_NORMAL_gc;
-	ULTRASONIC_TIMER.CTRLD = TC_EVACT_PW_gc | ULTRASONIC_EVSEL;	// Connect event channel 4 to timer
+	/* Initialize ultrasonic timer. Input capture rather than pulse width, since a
+	 * pulse width capture restarts the counter that all four channels share.
+	 */
+	ULTRASONIC_TIMER.CTRLB = TC0_CCAEN_bm | TC0_CCBEN_bm | TC0_CCCEN_bm | TC0_CCDEN_bm
+							 | TC_WGMODE_NORMAL_gc;
+	ULTRASONIC_TIMER.CTRLD = TC_EVACT_CAPT_gc | ULTRASONIC_EVSEL;	// Event channels 4-7 to CCA-CCD
 	ULTRASONIC_TIMER.INTCTRLA = TC_OVFINTLVL_MED_gc;
-	ULTRASONIC_TIMER.INTCTRLB = TC_CCAINTLVL_MED_gc;
-	ULTRASONIC_TIMER.PER = ULTRASONIC_TIMEOUT;
+	ULTRASONIC_TIMER.INTCTRLB = TC_CCAINTLVL_MED_gc | TC_CCBINTLVL_MED_gc
+								| TC_CCCINTLVL_MED_gc | TC_CCDINTLVL_MED_gc;
+	ULTRASONIC_TIMER.PER = ULTRASONIC_SLOT;		// Set per slot by ping_ultrasonic()
 	ULTRASONIC_TIMER.CTRLA = TC_CLKSEL_DIV64_gc;
 
 	/* Enable medium priority interrupts */
@@ -119,6 +537,7 @@ void init_ultrasonic()
 	sei();
 
 	/* Trigger first sensor measurement */
+	schedule_slot();
 	ping_ultrasonic();
 }
 
@@ -146,28 +565,309 @@ int get_ultrasonic_distance(ultrasonic_id_t index)
 
 
 /**
- * This interrupt is triggered when the duration of the echo pulse has been measured. The timer is
- * then reconfigured to generate a delay before the next measurement, to allow the echo to dissipate.
+ * Returns the filtered distance of an ultrasonic sensor
+ *
+ * @param index Sensor
+ * @param r Pointer to an ultrasonic_reading_t to fill in
+ */
+void ultrasonic_get_reading(ultrasonic_id_t index, ultrasonic_reading_t *r)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*r = *(ultrasonic_reading_t *)&usensors[index].reading;
+	}
+}
+
+
+/**
+ * Limit how far a sensor looks. Shorter ranges mean shorter slots, so every sensor
+ * refreshes faster when the others in its group are short too. Echoes from beyond
+ * the range read as -1.
+ *
+ * @param index Sensor
+ * @param range_mm Maximum range in mm, or 0 for the full ULTRASONIC_TIMEOUT
+ * @return True if the range was valid
+ */
+bool ultrasonic_set_range(ultrasonic_id_t index, unsigned int range_mm)
+{
+	unsigned long ticks = (range_mm == 0) ? ULTRASONIC_TIMEOUT : ULTRASONIC_MM_TO_TICKS(range_mm);
+
+	if(index >= ULTRASONIC_NUM_SENSORS || ticks < ULTRASONIC_MIN_RANGE || ticks > ULTRASONIC_TIMEOUT)
+		return false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		usensors[index].max_range = ticks;
+	}
+
+	return true;
+}
+
+
+/**
+ * Maximum range of a sensor in mm
+ */
+unsigned int ultrasonic_get_range(ultrasonic_id_t index)
+{
+	uint16_t ticks;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks = usensors[index].max_range;
+	}
+
+	return (unsigned long)ticks * 1000 / 2915;
+}
+
+
+/**
+ * Set how often each sensor is pinged while the robot is doing one thing. Only
+ * the ratios matter, e.g. a weight of 4 against 1 pings that sensor about three
+ * or four times as often.
+ *
+ * @param m Motion the weights apply to
+ * @param w ULTRASONIC_NUM_SENSORS weights in ultrasonic_id_t order, 0 to
+ * 		  ULTRASONIC_MAX_WEIGHT; 0 turns a sensor off
+ * @return True if the weights were valid
+ */
+bool ultrasonic_set_weights(ultrasonic_motion_t m, const uint8_t *w)
+{
+	uint8_t i;
+
+	if(m >= ULTRASONIC_NUM_MOTIONS)
+		return false;
+	for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+	{
+		if(w[i] > ULTRASONIC_MAX_WEIGHT)
+			return false;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+			weights[m][i] = w[i];
+	}
+
+	return true;
+}
+
+
+void ultrasonic_get_weights(ultrasonic_motion_t m, uint8_t *w)
+{
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+			w[i] = weights[m][i];
+	}
+}
+
+
+/**
+ * Motion the scheduler last saw
+ */
+ultrasonic_motion_t ultrasonic_get_motion(void)
+{
+	return motion;
+}
+
+
+/**
+ * Count the pings of each sensor since the last call, and start counting again
+ *
+ * @param pings Array of ULTRASONIC_NUM_SENSORS to fill in
+ * @return Milliseconds the counts cover
+ */
+unsigned int ultrasonic_get_rates(unsigned int *pings)
+{
+	unsigned long int now = get_tick_count();
+	unsigned long int elapsed;
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < ULTRASONIC_NUM_SENSORS; i++)
+		{
+			pings[i] = usensors[i].pings;
+			usensors[i].pings = 0;
+		}
+	}
+
+	elapsed = (now - rates_since) * MS_TIMER_PER;
+	rates_since = now;
+
+	return (elapsed > 0xffff) ? 0xffff : elapsed;
+}
+
+
+/**
+ * These interrupts are triggered on each edge of an echo pulse, one per capture channel.
  */
 ISR(ULTRASONIC_TIMER_VECT)
 {
 	DEBUG_ENTER_ISR(DEBUG_ISR_US_TIMER);
-	set_result(ULTRASONIC_TIMER.CCA);
+	capture(0);
+	DEBUG_EXIT_ISR(DEBUG_ISR_US_TIMER);
+}
+
+
+ISR(ULTRASONIC_TIMER_CCB_VECT)
+{
+	DEBUG_ENTER_ISR(DEBUG_ISR_US_TIMER);
+	capture(1);
+	DEBUG_EXIT_ISR(DEBUG_ISR_US_TIMER);
+}
+
+
+ISR(ULTRASONIC_TIMER_CCC_VECT)
+{
+	DEBUG_ENTER_ISR(DEBUG_ISR_US_TIMER);
+	capture(2);
+	DEBUG_EXIT_ISR(DEBUG_ISR_US_TIMER);
+}
+
+
+ISR(ULTRASONIC_TIMER_CCD_VECT)
+{
+	DEBUG_ENTER_ISR(DEBUG_ISR_US_TIMER);
+	capture(3);
 	DEBUG_EXIT_ISR(DEBUG_ISR_US_TIMER);
 }
 
 
 /**
- * This interrupt triggers the next sensor measurement.
+ * This interrupt ends the current slot, when the longest echo window has closed
+ * or shortly after every sensor answered. Any sensor that hasn't answered is out
+ * of range. Then the next slot is scheduled and triggered.
  */
 ISR(ULTRASONIC_TIMER_OVF_VECT)
 {
+	uint8_t channel;
+	uint8_t sensor;
+
 	DEBUG_ENTER_ISR(DEBUG_ISR_US_TIMER_OVF);
 
-	if(measurement_in_progress)
-		set_result(-1);
+	for(channel = 0; channel < ULTRASONIC_NUM_CHANNELS; channel++)
+	{
+		sensor = slot[channel];
+		if(sensor != NO_SENSOR && usensors[sensor].measuring)
+			set_result(sensor, -1);
+	}
 
+	schedule_slot();
 	ping_ultrasonic();
 
 	DEBUG_EXIT_ISR(DEBUG_ISR_US_TIMER_OVF);
 }
+
+
+/**
+ * Set the obstacle stop distance. The robot brakes, and the PID loop is disabled,
+ * when the sensor facing the way it's driving reads closer than
+ * base_mm + full_mm * speed / full speed. Only readings within the sensor's range
+ * (see ultrasonic_set_range()) count.
+ *
+ * @param base_mm Stopping distance when barely moving, or 0 to turn the stop off
+ * @param full_mm Distance added at full speed
+ * @return True if the distances were valid
+ */
+bool ultrasonic_set_stop(unsigned int base_mm, unsigned int full_mm)
+{
+	if((base_mm != 0 && base_mm < 100) || base_mm > ULTRASONIC_STOP_MAX || full_mm > ULTRASONIC_STOP_MAX)
+		return false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		stop_base = ULTRASONIC_MM_TO_TICKS(base_mm);
+		stop_full = ULTRASONIC_MM_TO_TICKS(full_mm);
+	}
+
+	return true;
+}
+
+
+/**
+ * Get the obstacle stop distances, in mm. base_mm is 0 if the stop is off.
+ */
+void ultrasonic_get_stop(unsigned int *base_mm, unsigned int *full_mm)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*base_mm = ULTRASONIC_TICKS_TO_MM(stop_base);
+		*full_mm = ULTRASONIC_TICKS_TO_MM(stop_full);
+	}
+}
+
+
+/**
+ * Number of times the obstacle stop or drop detection has braked since startup
+ */
+unsigned int ultrasonic_get_stops(void)
+{
+	unsigned int n;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		n = stops;
+	}
+
+	return n;
+}
+
+
+/**
+ * Longest time the obstacle stop has taken from the end of an echo to braking the
+ * motors, in us. This covers interrupt latency and the check itself; add the
+ * echo's own length and the time since the sensor's last ping for the whole
+ * reaction.
+ */
+unsigned int ultrasonic_get_stop_worst_us(void)
+{
+	uint16_t worst;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		worst = stop_worst;
+	}
+
+	return worst * 2;
+}
+
+
+/**
+ * Set how much further than the floor the bottom sensor has to read, while the
+ * robot is driving, for it to brake and post a "drop" event. No echo at all counts
+ * too. Stops are counted along with obstacle stops in ultrasonic_get_stops().
+ *
+ * @param rise_mm Rise in mm, or 0 to turn drop detection off
+ * @return True if the rise was valid
+ */
+bool ultrasonic_set_drop(unsigned int rise_mm)
+{
+	if(rise_mm != 0 && (rise_mm < ULTRASONIC_DROP_MIN || rise_mm > ULTRASONIC_DROP_MAX))
+		return false;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		drop_rise = rise_mm;
+	}
+
+	return true;
+}
+
+
+/**
+ * Get the drop detection rise in mm, 0 if it's off
+ */
+unsigned int ultrasonic_get_drop(void)
+{
+	unsigned int rise;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		rise = drop_rise;
+	}
+
+	return rise;
+}
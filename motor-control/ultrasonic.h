@@ -9,16 +9,53 @@
 #define ULTRASONIC_H_
 
 #include <avr/io.h>
+#include <stdbool.h>
 #include "clock.h"
 
+/* Sensors that don't hear each other are fired together, one per capture channel:
+ * event channels CH4-CH7 carry the echo pins to capture units CCA-CCD. The timer
+ * runs free for one slot per group, capturing both edges of each echo.
+ */
 #define ULTRASONIC_TIMER			TCE0
 #define ULTRASONIC_TIMER_VECT		TCE0_CCA_vect
+#define ULTRASONIC_TIMER_CCB_VECT	TCE0_CCB_vect
+#define ULTRASONIC_TIMER_CCC_VECT	TCE0_CCC_vect
+#define ULTRASONIC_TIMER_CCD_VECT	TCE0_CCD_vect
 #define ULTRASONIC_TIMER_OVF_VECT	TCE0_OVF_vect
 #define ULTRASONIC_TIMER_OVF_PER	5000						// 10 ms
-#define ULTRASONIC_CHMUX			EVSYS_CH4MUX
+#define ULTRASONIC_CHMUX			EVSYS_CH4MUX				// First of ULTRASONIC_NUM_CHANNELS
 #define ULTRASONIC_EVSEL			TC_EVSEL_CH4_gc
+#define ULTRASONIC_NUM_CHANNELS		4
 #define ULTRASONIC_NUM_SENSORS		5
 #define ULTRASONIC_TIMEOUT			19000						// 38 ms
+#define ULTRASONIC_ECHO_DELAY		500							// 1 ms, trigger to start of echo
+#define ULTRASONIC_SLOT				(ULTRASONIC_TIMEOUT + ULTRASONIC_ECHO_DELAY)	// Longest slot
+#define ULTRASONIC_SETTLE			2500						// 5 ms between the last echo and the next ping
+#define ULTRASONIC_MIN_RANGE		ULTRASONIC_MM_TO_TICKS(100)
+#define ULTRASONIC_MM_TO_TICKS(mm)	((unsigned long)(mm) * 2915 / 1000)	// .343 mm per tick
+#define ULTRASONIC_TICKS_TO_MM(t)	(((unsigned long)(t) * 22479) >> 16)	// .343 in Q16
+
+/* Filtering */
+#define ULTRASONIC_HISTORY			3							// Median of this many readings, odd
+#define ULTRASONIC_MIN_ECHO			58							// 2 cm, anything shorter is noise
+#define ULTRASONIC_NO_ECHO			0x7fff						// History entry for out of range
+#define ULTRASONIC_MAX_RATE			2000						// Fastest plausible change, mm/s
+#define ULTRASONIC_NOISE			30							// Change always allowed, mm
+#define ULTRASONIC_MAX_REJECTS		2							// Then a jump is believed
+
+/* Obstacle stop. The robot brakes when the front sensor (back when reversing) reads
+ * closer than base + full * speed / PWM_PERIOD mm. Off until ultrasonic_set_stop().
+ */
+#define ULTRASONIC_STOP_MAX			6500						// mm, for base and full
+
+/* Drop detection. While driving, ULTRASONIC_DROP_CONFIRM bottom sensor readings in
+ * a row this much further than the floor has been, or with no echo at all, brake
+ * the robot. Echoes too short to be the floor are ignored. Off until
+ * ultrasonic_set_drop().
+ */
+#define ULTRASONIC_DROP_MIN			20							// mm
+#define ULTRASONIC_DROP_MAX			1000						// mm
+#define ULTRASONIC_DROP_CONFIRM		2							// Readings in a row
 
 //#define ULTRASONIC_LEFT_INDEX		0
 #define ULTRASONIC_BACK_PORT		PORTA
@@ -51,12 +88,31 @@
 #define ULTRASONIC_LEFT_CHMUX		EVSYS_CHMUX_PORTA_PIN7_gc
 
 
+/**
+ * Filtered distance of one sensor
+ */
+typedef struct ultrasonic_reading {
+	int mm;						// Median of the last ULTRASONIC_HISTORY readings, or -1
+	bool valid;					// False if the median is out of range
+	unsigned long int time;		// tick_count of the last reading that got through
+} ultrasonic_reading_t;
+
 typedef struct ultrasonic {
 	PORT_t *port;
 	uint8_t trig_bm;
 	uint8_t echo_bm;
 	EVSYS_CHMUX_t echo_chmux;
 	int distance;
+	uint16_t max_range;			// Echoes longer than this are out of range, timer ticks
+	uint16_t rise;				// Capture at the start of the echo
+	bool measuring;				// Pinged, echo not finished
+	bool rise_seen;
+	uint8_t credit;				// Scheduler weight accumulated since the last ping
+	unsigned int pings;			// Since ultrasonic_get_rates() was last called
+	int16_t history[ULTRASONIC_HISTORY];	// mm, or ULTRASONIC_NO_ECHO
+	uint8_t history_index;
+	uint8_t rejects;			// Consecutive readings rejected as too big a jump
+	ultrasonic_reading_t reading;
 } ultrasonic_t;
 
 /* Constants correspond to indices in the usensors array */
@@ -68,8 +124,35 @@ typedef enum ultrasonic_id {
 	ULTRASONIC_BACK 	= 4
 } ultrasonic_id_t;
 
+/**
+ * What the robot is doing, as far as the scheduler is concerned. Each has its own
+ * set of sensor weights.
+ */
+typedef enum ultrasonic_motion {
+	ULTRASONIC_MOTION_STOPPED,
+	ULTRASONIC_MOTION_FORWARD,
+	ULTRASONIC_MOTION_REVERSE,
+	ULTRASONIC_MOTION_TURNING,
+	ULTRASONIC_NUM_MOTIONS
+} ultrasonic_motion_t;
+
+#define ULTRASONIC_MAX_WEIGHT		9
+
 void init_ultrasonic();
 int get_ultrasonic_distance(ultrasonic_id_t index);
+void ultrasonic_get_reading(ultrasonic_id_t index, ultrasonic_reading_t *r);
+bool ultrasonic_set_range(ultrasonic_id_t index, unsigned int range_mm);
+unsigned int ultrasonic_get_range(ultrasonic_id_t index);
+bool ultrasonic_set_weights(ultrasonic_motion_t motion, const uint8_t *weights);
+void ultrasonic_get_weights(ultrasonic_motion_t motion, uint8_t *weights);
+ultrasonic_motion_t ultrasonic_get_motion(void);
+unsigned int ultrasonic_get_rates(unsigned int *pings);
+bool ultrasonic_set_stop(unsigned int base_mm, unsigned int full_mm);
+void ultrasonic_get_stop(unsigned int *base_mm, unsigned int *full_mm);
+unsigned int ultrasonic_get_stops(void);
+unsigned int ultrasonic_get_stop_worst_us(void);
+bool ultrasonic_set_drop(unsigned int rise_mm);
+unsigned int ultrasonic_get_drop(void);
 
 
 #endif /* ULTRASONIC_H_ */